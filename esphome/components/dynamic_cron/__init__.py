@@ -1,7 +1,9 @@
+import re
 from time import time
 import esphome.codegen as cg
 import esphome.config_validation as cv
-from esphome.components import switch, text, text_sensor
+from esphome.components import sensor, switch, text, text_sensor
+from esphome.core import CORE
 from esphome.helpers import sanitize, snake_case
 from esphome.const import (
                       CONF_ID,
@@ -11,7 +13,7 @@ from esphome.const import (
 
 # Imports do not load files or paths into the build directory.                          
 # You need to use AUTO_LOAD.
-AUTO_LOAD          = ['switch', 'text', 'text_sensor']
+AUTO_LOAD          = ['sensor', 'switch', 'text', 'text_sensor']
 MULTI_CONF         = True
 
 # Our own custom config options for default member values:
@@ -19,16 +21,18 @@ CONF_BYPASS        = 'disabled'
 CONF_IGNORE_MISSED = 'ignore_missed'
 CONF_CRONTAB       = 'crontab'
 CONF_CLEAR_PREFS   = 'clear_prefs'
+CONF_NEXT_RUN_TIMESTAMP = 'next_run_timestamp'
+CONF_COUNTDOWN     = 'countdown'
+CONF_HISTORY       = 'history'
+CONF_DURATION      = 'duration'
+CONF_NVS_STATS     = 'nvs_stats'
+CONF_EXCLUSIONS    = 'exclusions'
+CONF_CRONTAB_ERROR = 'crontab_error'
+CONF_NVS_WRITE_BUDGET = 'nvs_write_budget'
+CONF_HISTORY_CHECKPOINT_INTERVAL = 'history_checkpoint_interval'
 
 cg.add_build_flag("-std=gnu++17")
-cg.add_build_flag("-fexceptions")
-cg.add_platformio_option("build_unflags", ["-fno-exceptions", "-std=gnu++11"])
-
-cg.add_library(
-    name="Croncpp",
-    repository="https://github.com/mariusbancila/croncpp.git",
-    version=None,
-)
+cg.add_platformio_option("build_unflags", ["-std=gnu++11"])
 
 cg.add_library(
     name="Preferences",
@@ -43,6 +47,30 @@ BypassSwitch        = dynamiccron_ns.class_('BypassSwitch', switch.Switch, cg.Co
 CrontabTextField    = dynamiccron_ns.class_('CrontabTextField', text.Text, cg.Component)
 CronNextSensor      = dynamiccron_ns.class_('CronNextSensor', text_sensor.TextSensor, cg.Component)
 IgnoreMissedSwitch  = dynamiccron_ns.class_('IgnoreMissedSwitch', switch.Switch, cg.Component)
+CronNextTimestampSensor = dynamiccron_ns.class_('CronNextTimestampSensor', text_sensor.TextSensor, cg.Component)
+CronCountdownSensor = dynamiccron_ns.class_('CronCountdownSensor', sensor.Sensor, cg.Component)
+CronHistorySensor   = dynamiccron_ns.class_('CronHistorySensor', text_sensor.TextSensor, cg.Component)
+NvsCounterSensor    = dynamiccron_ns.class_('NvsCounterSensor', sensor.Sensor, cg.Component)
+ExclusionsTextField = dynamiccron_ns.class_('ExclusionsTextField', text.Text, cg.Component)
+CrontabErrorSensor  = dynamiccron_ns.class_('CrontabErrorSensor', text_sensor.TextSensor, cg.Component)
+
+# Days in each month, in a leap year (Feb 29 can be excluded).
+MONTH_DAYS = [31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31]
+
+# Validates an exclusions list: MM-DD dates and MM-DD..MM-DD ranges,
+# separated by commas and/or spaces. Same rules as ExclusionCalendar::Parse().
+def validate_exclusions(value):
+    value = cv.string(value)
+    for item in value.replace(',', ' ').split():
+        for date in item.split('..', 1):
+            match = re.fullmatch(r'(\d{1,2})-(\d{1,2})', date)
+            if match is None:
+                raise cv.Invalid(f"Invalid exclusion '{item}', expected MM-DD or MM-DD..MM-DD")
+            month, day = int(match.group(1)), int(match.group(2))
+            if not (1 <= month <= 12 and 1 <= day <= MONTH_DAYS[month - 1]):
+                raise cv.Invalid(f"Invalid exclusion '{item}', '{date}' is not a valid date")
+    return value
+
 
 CONFIG_SCHEMA = cv.Schema({
     cv.Optional(CONF_NAME):                            cv.string,
@@ -51,7 +79,19 @@ CONFIG_SCHEMA = cv.Schema({
     cv.Optional(CONF_BYPASS, default=False):           cv.boolean,
     cv.Optional(CONF_IGNORE_MISSED, default=False):    cv.boolean,
     cv.Optional(CONF_CRONTAB, default=""):             cv.string,
-    cv.Optional(CONF_CLEAR_PREFS, default=False):      cv.boolean
+    cv.Optional(CONF_EXCLUSIONS):                      validate_exclusions,
+    cv.Optional(CONF_CRONTAB_ERROR, default=True):     cv.boolean,
+    cv.Optional(CONF_CLEAR_PREFS, default=False):      cv.boolean,
+    cv.Optional(CONF_DURATION, default='0s'):          cv.positive_time_period_seconds,
+    cv.Optional(CONF_NEXT_RUN_TIMESTAMP, default=False): cv.boolean,
+    cv.Optional(CONF_COUNTDOWN, default=False):        cv.boolean,
+    cv.Optional(CONF_HISTORY, default=False):          cv.boolean,
+    # Capped below 2^32 ms, since the checkpoint timing runs on millis().
+    cv.Optional(CONF_HISTORY_CHECKPOINT_INTERVAL, default='1h'): cv.All(
+        cv.positive_time_period_seconds, cv.Range(max=cv.TimePeriod(days=49))
+    ),
+    cv.Optional(CONF_NVS_STATS, default=False):        cv.boolean,
+    cv.Optional(CONF_NVS_WRITE_BUDGET, default=0):     cv.positive_int
 }).extend(cv.COMPONENT_SCHEMA)
 
 
@@ -60,6 +100,11 @@ global_timestamp = cg.RawStatement(f'esphome::dynamic_cron::TIMESTAMP = {round(t
 cg.add(global_timestamp)
 
 
+# The global nvs sensors are created (once) with the first schedule that has nvs_stats.
+# Tracked in CORE.data, which is reset for each config compiled in this process.
+DATA_NVS_GLOBAL_SENSORS = 'dynamic_cron_nvs_global_sensors'
+
+
 # This gets called for each item in the dynamic_cron:[] array in the yaml config.
 async def to_code(config):
 
@@ -89,7 +134,12 @@ async def to_code(config):
     cg.add(var.setBypassDefault(config[CONF_BYPASS]))
     cg.add(var.setIgnoreMissedDefault(config[CONF_IGNORE_MISSED]))
     cg.add(var.setCrontabDefault(config[CONF_CRONTAB]))
+    if CONF_EXCLUSIONS in config:
+        cg.add(var.setExclusionsDefault(config[CONF_EXCLUSIONS]))
     cg.add(var.setClearPrefs(config[CONF_CLEAR_PREFS]))
+    cg.add(var.setDuration(config[CONF_DURATION].total_seconds))
+    cg.add(var.setHistoryCheckpointInterval(config[CONF_HISTORY_CHECKPOINT_INTERVAL].total_seconds))
+    cg.add(var.setNvsWriteBudget(config[CONF_NVS_WRITE_BUDGET]))
     
     
     bypass_switch = cg.RawStatement(
@@ -119,10 +169,83 @@ async def to_code(config):
     cg.add(cron_next_sensor)
     
     
+    if config[CONF_NEXT_RUN_TIMESTAMP]:
+        cron_next_timestamp_sensor = cg.RawStatement(
+          f'esphome::dynamic_cron::CronNextTimestampSensor *cron_next_timestamp_sensor_{id_} = new esphome::dynamic_cron::CronNextTimestampSensor({id_});\n' +
+          f'cron_next_timestamp_sensor_{id_}->set_name("{name} next run timestamp");\n' +
+          f'cron_next_timestamp_sensor_{id_}->set_object_id("cron_next_timestamp_sensor_{id_}");\n'
+        )
+        cg.add(cron_next_timestamp_sensor)
+    
+    
+    if config[CONF_COUNTDOWN]:
+        cron_countdown_sensor = cg.RawStatement(
+          f'esphome::dynamic_cron::CronCountdownSensor *cron_countdown_sensor_{id_} = new esphome::dynamic_cron::CronCountdownSensor({id_});\n' +
+          f'cron_countdown_sensor_{id_}->set_name("{name} countdown");\n' +
+          f'cron_countdown_sensor_{id_}->set_object_id("cron_countdown_sensor_{id_}");\n'
+        )
+        cg.add(cron_countdown_sensor)
+    
+    
+    if config[CONF_HISTORY]:
+        cron_history_sensor = cg.RawStatement(
+          f'esphome::dynamic_cron::CronHistorySensor *cron_history_sensor_{id_} = new esphome::dynamic_cron::CronHistorySensor({id_});\n' +
+          f'cron_history_sensor_{id_}->set_name("{name} history");\n' +
+          f'cron_history_sensor_{id_}->set_object_id("cron_history_sensor_{id_}");\n'
+        )
+        cg.add(cron_history_sensor)
+    
+    
+    # Numeric counters: {suffix, C++ counter, name}.
+    nvs_counters = [
+        ('opens',    'OPENS',    'nvs opens'),
+        ('reads',    'READS',    'nvs reads'),
+        ('writes',   'WRITES',   'nvs writes'),
+        ('bytes',    'BYTES',    'nvs bytes written'),
+        ('deferred', 'DEFERRED', 'nvs deferred writes'),
+    ]
+    
+    if config[CONF_NVS_STATS]:
+        for suffix, counter, label in nvs_counters:
+            nvs_counter_sensor = cg.RawStatement(
+              f'esphome::dynamic_cron::NvsCounterSensor *nvs_{suffix}_sensor_{id_} = new esphome::dynamic_cron::NvsCounterSensor({id_}, esphome::dynamic_cron::NvsCounterSensor::{counter});\n' +
+              f'nvs_{suffix}_sensor_{id_}->set_name("{name} {label}");\n' +
+              f'nvs_{suffix}_sensor_{id_}->set_object_id("nvs_{suffix}_sensor_{id_}");\n'
+            )
+            cg.add(nvs_counter_sensor)
+        
+        if not CORE.data.get(DATA_NVS_GLOBAL_SENSORS, False):
+            for suffix, counter, label in nvs_counters:
+                nvs_global_sensor = cg.RawStatement(
+                  f'esphome::dynamic_cron::NvsCounterSensor *nvs_{suffix}_sensor_dynamic_cron = new esphome::dynamic_cron::NvsCounterSensor(nullptr, esphome::dynamic_cron::NvsCounterSensor::{counter});\n' +
+                  f'nvs_{suffix}_sensor_dynamic_cron->set_name("Dynamic cron {label}");\n' +
+                  f'nvs_{suffix}_sensor_dynamic_cron->set_object_id("nvs_{suffix}_sensor_dynamic_cron");\n'
+                )
+                cg.add(nvs_global_sensor)
+            CORE.data[DATA_NVS_GLOBAL_SENSORS] = True
+    
+    
     crontab_text_field = cg.RawStatement(
       f'esphome::dynamic_cron::CrontabTextField *crontab_text_field_{id_} = new esphome::dynamic_cron::CrontabTextField({id_});\n' +
       f'crontab_text_field_{id_}->set_name("{name} crontab");\n' +
       f'crontab_text_field_{id_}->set_object_id("crontab_text_field_{id_}");\n'
     )
     cg.add(crontab_text_field)
-
+    
+    
+    if config[CONF_CRONTAB_ERROR]:
+        crontab_error_sensor = cg.RawStatement(
+          f'esphome::dynamic_cron::CrontabErrorSensor *crontab_error_sensor_{id_} = new esphome::dynamic_cron::CrontabErrorSensor({id_});\n' +
+          f'crontab_error_sensor_{id_}->set_name("{name} crontab error");\n' +
+          f'crontab_error_sensor_{id_}->set_object_id("crontab_error_sensor_{id_}");\n'
+        )
+        cg.add(crontab_error_sensor)
+    
+    
+    if CONF_EXCLUSIONS in config:
+        exclusions_text_field = cg.RawStatement(
+          f'esphome::dynamic_cron::ExclusionsTextField *exclusions_text_field_{id_} = new esphome::dynamic_cron::ExclusionsTextField({id_});\n' +
+          f'exclusions_text_field_{id_}->set_name("{name} exclusions");\n' +
+          f'exclusions_text_field_{id_}->set_object_id("exclusions_text_field_{id_}");\n'
+        )
+        cg.add(exclusions_text_field)
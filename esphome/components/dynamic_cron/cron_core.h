@@ -0,0 +1,963 @@
+#pragma once
+
+#include "esphome/core/log.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <map>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <strings.h>
+#include <vector>
+
+
+// Cron parsing and next-time search, TZ transitions, exclusion calendars, interned
+// crontabs, and the timing math used by Schedule. None of this depends on ESPHome components (only the logging macros),
+// so it can be built and tested on the host. See tests/host.
+
+
+namespace esphome {
+namespace dynamic_cron {
+
+
+// Local-time offset transitions for the configured TZ, precomputed from libc
+// once (per year of coverage), so next-time searches can work in UTC with plain
+// arithmetic, instead of calling localtime/mktime for every candidate time.
+//
+// Wall times skipped by a forward (spring) transition map to the transition instant.
+// Wall times repeated by a backward (fall) transition map to their first occurrence,
+// unless the latest occurrence is asked for. Times outside the table use libc, with
+// the same rules.
+class TzTable {
+public:
+  
+  // UTC offset (seconds east) in effect from UTC time 'at'.
+  struct Transition {
+    std::time_t   at;
+    int32_t       offset;
+  };
+  
+  static constexpr std::time_t SPAN   = 366 * 86400; // coverage built ahead of a requested time
+  static constexpr std::time_t MARGIN = 31 * 86400;  // extend coverage when closer than this to the end
+  static constexpr std::time_t STEP   = 86400;       // sampling step, when searching for transitions
+  static constexpr std::time_t MIN_VALID = 1577836800; // 2020-01-01, anything earlier is an unsynced clock
+  
+  // Shared table for the device TZ.
+  static TzTable& Local() {
+    static TzTable table;
+    return table;
+  }
+  
+  
+  // Makes sure the table was built for the current TZ setting and covers 'utc'
+  // (with some margin), rebuilding it around 'utc' if needed. Nothing is built from
+  // an invalid (unsynced) time, lookups then fall back to libc.
+  void ensure(std::time_t utc) {
+    const char *tz = getenv("TZ");
+    if (tz == nullptr) { tz = ""; }
+    
+    if (tz_name != tz) {
+      tz_name = tz;
+      built = false;
+    }
+    if (utc < MIN_VALID) { return; }
+    
+    if (!built || utc < start || utc >= end + SPAN) {
+      build(utc - 86400);
+      extend(utc + SPAN);
+    }
+    else if (utc + MARGIN > end) {
+      // Keeps the table small, if searches walk far ahead.
+      if (end - start > 2 * SPAN) { build(utc - 86400); }
+      extend(utc + SPAN);
+    }
+  }
+  
+  
+  // UTC offset in effect at 'utc'.
+  int32_t offsetAt(std::time_t utc) const {
+    if (!built || utc < start || utc >= end) { return LibcOffset(utc); }
+    
+    int32_t out = base_offset;
+    for (auto& tr : transitions) {
+      if (utc < tr.at) { break; }
+      out = tr.offset;
+    }
+    return out;
+  }
+  
+  
+  // Converts UTC to wall time (local time, expressed as seconds in a UTC-like epoch).
+  std::time_t toWall(std::time_t utc) const {
+    return utc + offsetAt(utc);
+  }
+  
+  
+  // Converts wall time to UTC. See class comment for skipped and repeated times.
+  std::time_t toUtc(std::time_t wall, bool latest = false) const {
+    if (!built || wall - 86400 < start || wall + 86400 >= end) {
+      return LibcToUtc(wall, latest);
+    }
+    
+    // Each segment of constant offset, in order, so the first match is the earliest.
+    std::time_t found = 0;
+    for (size_t k = 0; k <= transitions.size(); k++) {
+      int32_t offset = (k == 0) ? base_offset : transitions[k - 1].offset;
+      std::time_t lo = (k == 0) ? start : transitions[k - 1].at;
+      std::time_t hi = (k == transitions.size()) ? end : transitions[k].at;
+      std::time_t utc = wall - offset;
+      if (utc >= lo && utc < hi) {
+        if (!latest) { return utc; }
+        found = utc;
+      }
+    }
+    if (found != 0) { return found; }
+    
+    // Skipped by a forward transition.
+    int32_t prev = base_offset;
+    for (auto& tr : transitions) {
+      if (tr.offset > prev && wall >= tr.at + prev && wall < tr.at + tr.offset) {
+        return tr.at;
+      }
+      prev = tr.offset;
+    }
+    
+    return wall - base_offset;
+  }
+  
+  
+  // If 'utc' is in the second pass of a repeated (fall-back) interval, returns the
+  // wall time at the end of the repeated interval, so searches don't fire twice.
+  // Otherwise returns 0.
+  std::time_t repeatedWallEnd(std::time_t utc) const {
+    int32_t prev = base_offset;
+    for (auto& tr : transitions) {
+      if (tr.offset < prev && utc >= tr.at && utc < tr.at + (prev - tr.offset)) {
+        return tr.at + prev;
+      }
+      prev = tr.offset;
+    }
+    return 0;
+  }
+  
+  
+  // The first backward (fall-back) transition after 'utc' within the table, or nullptr.
+  // Sets 'before' to the offset it replaces, so wall times from tr.at + tr.offset up
+  // to tr.at + before repeat.
+  const Transition* nextRepeat(std::time_t utc, int32_t& before) const {
+    int32_t prev = base_offset;
+    for (auto& tr : transitions) {
+      if (tr.offset < prev && tr.at > utc) {
+        before = prev;
+        return &tr;
+      }
+      prev = tr.offset;
+    }
+    return nullptr;
+  }
+  
+  
+  const std::vector<Transition>& getTransitions() const {
+    return transitions;
+  }
+  
+  
+  // Days since 1970-01-01 for a civil date (proleptic Gregorian).
+  // See http://howardhinnant.github.io/date_algorithms.html
+  static int64_t DaysFromCivil(int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = (unsigned) (y - era * 400);
+    const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t) doe - 719468;
+  }
+  
+  
+  // Civil date for days since 1970-01-01 (inverse of DaysFromCivil).
+  static void CivilFromDays(int64_t z, int64_t& y, unsigned& m, unsigned& d) {
+    z += 719468;
+    const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const unsigned doe = (unsigned) (z - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    d = doy - (153 * mp + 2) / 5 + 1;
+    m = mp < 10 ? mp + 3 : mp - 9;
+    y = (int64_t) yoe + era * 400 + (m <= 2);
+  }
+  
+  
+  // Day of week (0 = Sunday) for days since 1970-01-01.
+  static unsigned WeekdayFromDays(int64_t z) {
+    return (unsigned) (z >= -4 ? (z + 4) % 7 : (z + 5) % 7 + 6);
+  }
+  
+  
+  // UTC offset at 'utc' according to libc (slow path, used to build the table).
+  static int32_t LibcOffset(std::time_t utc) {
+    struct tm tm_local;
+    localtime_r(&utc, &tm_local);
+    int64_t wall = DaysFromCivil(tm_local.tm_year + 1900, tm_local.tm_mon + 1, tm_local.tm_mday) * 86400 +
+                   tm_local.tm_hour * 3600 + tm_local.tm_min * 60 + tm_local.tm_sec;
+    return (int32_t) (wall - utc);
+  }
+  
+  
+  // First second after 'lo' (up to 'hi') with a different libc offset than 'lo'.
+  static std::time_t LibcTransition(std::time_t lo, std::time_t hi) {
+    int32_t prev = LibcOffset(lo);
+    while (hi - lo > 1) {
+      std::time_t mid = lo + (hi - lo) / 2;
+      if (LibcOffset(mid) == prev) { lo = mid; } else { hi = mid; }
+    }
+    return hi;
+  }
+  
+  
+  // Wall time to UTC according to libc, assuming at most one transition within a day.
+  static std::time_t LibcToUtc(std::time_t wall, bool latest) {
+    int32_t early = LibcOffset(wall - 86400);
+    int32_t late  = LibcOffset(wall + 86400);
+    std::time_t a = wall - early, b = wall - late;
+    bool a_valid = (LibcOffset(a) == early);
+    bool b_valid = (LibcOffset(b) == late);
+    
+    if (a_valid && b_valid) { return latest ? std::max(a, b) : std::min(a, b); }
+    if (a_valid) { return a; }
+    if (b_valid) { return b; }
+    
+    // Skipped by a forward transition, which lies in (b, a].
+    return LibcTransition(b, a);
+  }
+  
+  
+private:
+  
+  bool                      built = false;
+  std::string               tz_name;
+  std::time_t               start = 0;
+  std::time_t               end = 0;
+  int32_t                   base_offset = 0;
+  std::vector<Transition>   transitions;
+  
+  
+  void build(std::time_t from) {
+    transitions.clear();
+    start = from;
+    end = from;
+    base_offset = LibcOffset(from);
+    built = true;
+  }
+  
+  
+  // Samples libc daily from the current end up to 'to', and bisects each offset
+  // change down to the second.
+  void extend(std::time_t to) {
+    int32_t prev = transitions.empty() ? base_offset : transitions.back().offset;
+    std::time_t lo = end;
+    
+    while (lo < to) {
+      std::time_t hi = std::min(lo + STEP, to);
+      int32_t offset = LibcOffset(hi);
+      
+      if (offset != prev) {
+        transitions.push_back({LibcTransition(lo, hi), offset});
+        prev = offset;
+      }
+      lo = hi;
+    }
+    
+    end = to;
+    ESP_LOGD("schedules", "TZ table covers %lld to %lld with %u transitions", (long long) start, (long long) end, transitions.size());
+  }
+  
+}; // TzTable class
+
+
+// Days excluded from a schedule (holidays, rain days...), as a bitmap with one bit per
+// day of the year. Days are indexed by month and day in a leap-year layout (Jan 1 = 0,
+// Feb 29 = 59, Dec 31 = 365), so a date keeps the same bit every year. 46 bytes.
+struct ExclusionCalendar {
+  uint8_t   bits[46] = {0};
+  
+  static constexpr int DAYS = 366;
+  
+  
+  // Day index (0-365) for month 1-12 and day 1-31. Returns -1 if not a valid date.
+  static int DayIndex(unsigned month, unsigned day) {
+    static const uint16_t month_start[13]  = {0, 0, 31, 60, 91, 121, 152, 182, 213, 244, 274, 305, 335};
+    static const uint8_t  month_length[13] = {0, 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    if (month < 1 || month > 12 || day < 1 || day > month_length[month]) { return -1; }
+    return month_start[month] + day - 1;
+  }
+  
+  
+  // Month and day for a day index (inverse of DayIndex).
+  static void MonthDay(int index, unsigned& month, unsigned& day) {
+    month = 12;
+    while (DayIndex(month, 1) > index) { month--; }
+    day = index - DayIndex(month, 1) + 1;
+  }
+  
+  
+  // Constant-time lookup.
+  bool excluded(unsigned month, unsigned day) const {
+    int index = DayIndex(month, day);
+    return index >= 0 && (bits[index >> 3] >> (index & 7) & 1);
+  }
+  
+  
+  void set(int index, bool val) {
+    if (val) {
+      bits[index >> 3] |= (1 << (index & 7));
+    } else {
+      bits[index >> 3] &= ~(1 << (index & 7));
+    }
+  }
+  
+  
+  // Is the local day of UTC time 'utc' excluded?
+  bool excludedAt(std::time_t utc) const {
+    int64_t y;
+    unsigned month, day;
+    std::time_t wall = TzTable::Local().toWall(utc);
+    TzTable::CivilFromDays(wall / 86400, y, month, day);
+    return excluded(month, day);
+  }
+  
+  
+  bool empty() const {
+    return std::all_of(std::begin(bits), std::end(bits), [](uint8_t b) { return b == 0; });
+  }
+  
+  
+  // Parses a list of dates 'MM-DD' and ranges 'MM-DD..MM-DD', separated by commas and/or spaces.
+  // A range may wrap past the end of the year (12-24..01-02). Returns false if invalid.
+  static bool Parse(const std::string& text, ExclusionCalendar& out) {
+    ExclusionCalendar cal;
+    std::string normalized(text);
+    std::replace(normalized.begin(), normalized.end(), ',', ' ');
+    std::stringstream stream(normalized);
+    std::string item;
+    
+    while (stream >> item) {
+      size_t dots = item.find("..");
+      int first = ParseDate(item.substr(0, dots));
+      int last = (dots == std::string::npos) ? first : ParseDate(item.substr(dots + 2));
+      if (first < 0 || last < 0) { return false; }
+      
+      for (int i = first; ; i = (i + 1) % DAYS) {
+        cal.set(i, true);
+        if (i == last) { break; }
+      }
+    }
+    
+    out = cal;
+    return true;
+  }
+  
+  
+  // Builds the list of excluded dates, with consecutive days as ranges.
+  // Ex: "01-01, 07-04, 12-24..12-26"
+  std::string toString() const {
+    std::string out;
+    int i = 0;
+    while (i < DAYS) {
+      if (!(bits[i >> 3] >> (i & 7) & 1)) { i++; continue; }
+      int first = i;
+      while (i + 1 < DAYS && (bits[(i + 1) >> 3] >> ((i + 1) & 7) & 1)) { i++; }
+      
+      unsigned month, day;
+      char str[16];
+      MonthDay(first, month, day);
+      snprintf(str, sizeof(str), "%02u-%02u", month, day);
+      if (!out.empty()) { out += ", "; }
+      out += str;
+      if (i > first) {
+        MonthDay(i, month, day);
+        snprintf(str, sizeof(str), "..%02u-%02u", month, day);
+        out += str;
+      }
+      i++;
+    }
+    return out;
+  }
+  
+  
+  // Parses 'MM-DD' into a day index, or -1.
+  static int ParseDate(const std::string& str) {
+    unsigned month, day;
+    char extra;
+    if (sscanf(str.c_str(), "%2u-%2u%c", &month, &day, &extra) != 2) { return -1; }
+    return DayIndex(month, day);
+  }
+  
+}; // ExclusionCalendar struct
+
+
+// A compiled cron expression (6 fields: second minute hour day-of-month month day-of-week),
+// in the same syntax as croncpp: '*', '?', lists, ranges, steps, and JAN-DEC / SUN-SAT names.
+// Like croncpp, day-of-month AND day-of-week must both match.
+struct CronExpr {
+  uint64_t  seconds = 0;        // bits 0-59
+  uint64_t  minutes = 0;        // bits 0-59
+  uint32_t  hours = 0;          // bits 0-23
+  uint32_t  days_of_month = 0;  // bits 1-31
+  uint16_t  months = 0;         // bits 1-12
+  uint8_t   days_of_week = 0;   // bits 0-6, Sunday = 0
+  
+  static constexpr int MAX_SEARCH_DAYS = 366 * 8;
+  static constexpr uint32_t ALL_HOURS = 0xFFFFFF;
+  
+  
+  // Parses a single cron expression. Returns false if invalid, and if 'error' is given,
+  // describes which field failed and why. Never throws.
+  static bool Parse(const std::string& text, CronExpr& out, std::string* error = nullptr) {
+    static const char* const month_names[] = {"JAN","FEB","MAR","APR","MAY","JUN","JUL","AUG","SEP","OCT","NOV","DEC", nullptr};
+    static const char* const day_names[]   = {"SUN","MON","TUE","WED","THU","FRI","SAT", nullptr};
+    
+    // {name, min, max, names, names_base, allow '?'}
+    struct FieldSpec {
+      const char          *name;
+      int                 min;
+      int                 max;
+      const char* const   *names;
+      int                 names_base;
+      bool                allow_any;
+    };
+    static const FieldSpec specs[6] = {
+      {"second",        0, 59, nullptr,     0, false},
+      {"minute",        0, 59, nullptr,     0, false},
+      {"hour",          0, 23, nullptr,     0, false},
+      {"day-of-month",  1, 31, nullptr,     0, true},
+      {"month",         1, 12, month_names, 1, false},
+      {"day-of-week",   0, 6,  day_names,   0, true}
+    };
+    
+    std::vector<std::string> fields;
+    std::stringstream stream(text);
+    std::string field;
+    while (stream >> field) { fields.push_back(field); }
+    if (fields.size() != 6) {
+      if (error != nullptr) { *error = "expected 6 fields, found " + std::to_string(fields.size()); }
+      return false;
+    }
+    
+    uint64_t bits[6] = {0};
+    for (int f = 0; f < 6; f++) {
+      const FieldSpec& spec = specs[f];
+      std::string reason;
+      if (!ParseField(fields[f], spec.min, spec.max, spec.names, spec.names_base, spec.allow_any, bits[f], reason)) {
+        if (error != nullptr) {
+          *error = "field " + std::to_string(f + 1) + " (" + spec.name + ") '" + fields[f] + "': " + reason;
+        }
+        return false;
+      }
+    }
+    
+    out.seconds       = bits[0];
+    out.minutes       = bits[1];
+    out.hours         = (uint32_t) bits[2];
+    out.days_of_month = (uint32_t) bits[3];
+    out.months        = (uint16_t) bits[4];
+    out.days_of_week  = (uint8_t) bits[5];
+    return true;
+  }
+  
+  
+  // Returns the first run strictly after UTC time 'utc', or 0 if none.
+  // Days in 'exclusions' (if given) are skipped.
+  //
+  // Like Vixie cron, DST changes treat entries with a fixed hour and with a wildcard
+  // hour ('*') differently. A fixed hour runs once in a repeated (fall-back) hour, on
+  // its first pass, and a skipped (spring-forward) time runs at the transition instant.
+  // A wildcard hour keeps running through the second pass of a repeated hour, and
+  // just has no runs in a skipped hour, so intervals keep their pace.
+  std::time_t next(std::time_t utc, const ExclusionCalendar* exclusions = nullptr) const {
+    TzTable& tz = TzTable::Local();
+    tz.ensure(utc);
+    
+    bool any_hour = (hours == ALL_HOURS);
+    std::time_t from = tz.toWall(utc) + 1;
+    if (!any_hour) { from = std::max(from, tz.repeatedWallEnd(utc)); }
+    
+    // A few rounds at most: a wall time can map back to (or before) 'utc' when it was
+    // already passed in the first pass of a repeated hour.
+    for (int round = 0; round < 4; round++) {
+      std::time_t wall = nextWall(from, exclusions);
+      if (wall == 0) { return 0; }
+      
+      std::time_t out = tz.toUtc(wall);
+      if (any_hour) {
+        if (tz.toWall(out) != wall) {
+          from = tz.toWall(out);
+          continue;
+        }
+        if (out <= utc) { out = tz.toUtc(wall, true); }
+        
+        // The second pass of an upcoming repeated hour may come first.
+        int32_t before = 0;
+        const TzTable::Transition* tr = tz.nextRepeat(utc, before);
+        if (tr != nullptr && out > tr->at) {
+          std::time_t repeat = nextWall(tr->at + tr->offset, exclusions);
+          if (repeat != 0 && repeat < tr->at + before) {
+            out = std::min(out, repeat - tr->offset);
+          }
+        }
+      }
+      
+      if (out > utc) { return out; }
+      from = wall + 1;
+    }
+    return 0;
+  }
+  
+  
+  // Returns the first matching wall time at or after 'from', or 0 if none.
+  // Pure arithmetic, no libc time calls.
+  std::time_t nextWall(std::time_t from, const ExclusionCalendar* exclusions = nullptr) const {
+    int64_t days = from / 86400;
+    int sod = (int) (from - days * 86400); // second of day
+    
+    for (int i = 0; i < MAX_SEARCH_DAYS; i++, days++, sod = 0) {
+      int64_t y;
+      unsigned m, d;
+      TzTable::CivilFromDays(days, y, m, d);
+      
+      if (!(months >> m & 1)) {
+        // Skips to the last day of this month (loop moves to the 1st of next).
+        days = TzTable::DaysFromCivil(m == 12 ? y + 1 : y, m == 12 ? 1 : m + 1, 1) - 1;
+        continue;
+      }
+      if (!(days_of_month >> d & 1) || !(days_of_week >> TzTable::WeekdayFromDays(days) & 1)) {
+        continue;
+      }
+      if (exclusions != nullptr && exclusions->excluded(m, d)) {
+        continue;
+      }
+      
+      int t = nextTimeOfDay(sod);
+      if (t >= 0) {
+        return (std::time_t) (days * 86400 + t);
+      }
+    }
+    return 0;
+  }
+  
+  
+  // Returns first matching second-of-day at or after 'sod', or -1 if none today.
+  int nextTimeOfDay(int sod) const {
+    int h0 = sod / 3600, m0 = (sod / 60) % 60, s0 = sod % 60;
+    
+    for (int h = NextBit(hours, h0); h >= 0; h = NextBit(hours, h + 1)) {
+      int m_from = (h == h0) ? m0 : 0;
+      for (int m = NextBit(minutes, m_from); m >= 0; m = NextBit(minutes, m + 1)) {
+        int s = NextBit(seconds, (h == h0 && m == m0) ? s0 : 0);
+        if (s >= 0) {
+          return h * 3600 + m * 60 + s;
+        }
+      }
+    }
+    return -1;
+  }
+  
+  
+  // Index of the first set bit at or above 'from', or -1.
+  static int NextBit(uint64_t bits, int from) {
+    if (from >= 64) { return -1; }
+    uint64_t masked = bits & (~0ULL << from);
+    return masked ? __builtin_ctzll(masked) : -1;
+  }
+  
+  
+  // Parses one field (comma-separated list of '*', 'N', 'N-M', with optional '/step').
+  // 'names' are matched case-insensitively and numbered from 'names_base'.
+  // On failure, 'reason' says what was wrong.
+  static bool ParseField(const std::string& field, int min, int max, const char* const* names, int names_base, bool allow_any, uint64_t& bits, std::string& reason) {
+    size_t pos = 0;
+    while (pos <= field.size()) {
+      size_t comma = field.find(',', pos);
+      if (comma == std::string::npos) { comma = field.size(); }
+      std::string item = field.substr(pos, comma - pos);
+      pos = comma + 1;
+      
+      int step = 1;
+      size_t slash = item.find('/');
+      if (slash != std::string::npos) {
+        if (!ParseValue(item.substr(slash + 1), 1, max - min + 1, nullptr, 0, step, reason)) {
+          reason = "step " + reason;
+          return false;
+        }
+        item = item.substr(0, slash);
+      }
+      
+      int lo, hi;
+      if (item == "*" || (allow_any && item == "?")) {
+        lo = min;
+        hi = max;
+      }
+      else {
+        size_t dash = item.find('-');
+        if (dash == std::string::npos) {
+          if (!ParseValue(item, min, max, names, names_base, lo, reason)) { return false; }
+          hi = (slash != std::string::npos) ? max : lo;
+        }
+        else {
+          if (!ParseValue(item.substr(0, dash), min, max, names, names_base, lo, reason) ||
+              !ParseValue(item.substr(dash + 1), min, max, names, names_base, hi, reason)
+          ){
+            return false;
+          }
+          if (lo > hi) {
+            reason = "range '" + item + "' is reversed";
+            return false;
+          }
+        }
+      }
+      
+      for (int v = lo; v <= hi; v += step) {
+        bits |= (1ULL << v);
+      }
+    }
+    return true;
+  }
+  
+  
+  // Parses a number or name within [min, max].
+  static bool ParseValue(const std::string& str, int min, int max, const char* const* names, int names_base, int& out, std::string& reason) {
+    if (str.empty()) {
+      reason = "missing value";
+      return false;
+    }
+    
+    if (std::all_of(str.begin(), str.end(), ::isdigit)) {
+      out = 0;
+      for (char c : str) {
+        out = out * 10 + (c - '0');
+        if (out > max) { break; }
+      }
+      if (out < min || out > max) {
+        reason = "'" + str + "' is out of range " + std::to_string(min) + "-" + std::to_string(max);
+        return false;
+      }
+      return true;
+    }
+    
+    for (int i = 0; names != nullptr && names[i] != nullptr; i++) {
+      if (strcasecmp(str.c_str(), names[i]) == 0) {
+        out = names_base + i;
+        return true;
+      }
+    }
+    reason = "'" + str + "' is not a valid value";
+    return false;
+  }
+  
+}; // CronExpr struct
+
+
+// A compiled crontab, interned and reference-counted, so schedules with the same
+// crontab share one copy of the text and compiled expressions. The next time from a
+// given reference time is cached, so within one tick it's computed once for all of them.
+// Keyed by normalized text (see Normalize()).
+struct SharedCrontab {
+  std::string           text;
+  std::vector<CronExpr> exprs;
+  uint16_t              refs = 0;
+  std::time_t           cached_ref = 0;   // reference time of cached_next
+  std::time_t           cached_next = 0;  // first run after cached_ref (without exclusions)
+  
+  
+  // All live entries.
+  static std::vector<SharedCrontab*>& Registry() {
+    static std::vector<SharedCrontab*> registry;
+    return registry;
+  }
+  
+  
+  // Gets the entry for crontab text, creating and compiling it if needed.
+  // Adds a reference. Returns nullptr for an empty crontab.
+  static SharedCrontab* Acquire(const std::string& crontab) {
+    std::string normalized = Normalize(crontab);
+    if (normalized == "") { return nullptr; }
+    
+    for (auto entry : Registry()) {
+      if (entry->text == normalized) {
+        return Retain(entry);
+      }
+    }
+    
+    SharedCrontab *entry = new SharedCrontab();
+    entry->text = normalized;
+    size_t pos = 0;
+    while (pos < normalized.size()) {
+      size_t bar = normalized.find(" | ", pos);
+      if (bar == std::string::npos) { bar = normalized.size(); }
+      std::string item = normalized.substr(pos, bar - pos);
+      pos = bar + 3;
+      
+      // Crontabs are validated before they get here (see Schedule::setCrontab()),
+      // except ones saved in prefs by an older version. Those are skipped.
+      CronExpr expr;
+      std::string reason;
+      if (CronExpr::Parse(item, expr, &reason)) {
+        entry->exprs.push_back(expr);
+      }
+      else {
+        ESP_LOGE("schedules", "Skipping invalid cron expression '%s': %s", item.c_str(), reason.c_str());
+      }
+    }
+    
+    Registry().push_back(entry);
+    ESP_LOGD("schedules", "Interned crontab '%s' (%u distinct)", normalized.c_str(), Registry().size());
+    return Retain(entry);
+  }
+  
+  
+  static SharedCrontab* Retain(SharedCrontab* entry) {
+    if (entry != nullptr) { entry->refs++; }
+    return entry;
+  }
+  
+  
+  // Drops a reference, and deletes the entry when it's no longer used.
+  static void Release(SharedCrontab* entry) {
+    if (entry == nullptr || --entry->refs > 0) { return; }
+    auto& registry = Registry();
+    registry.erase(std::remove(registry.begin(), registry.end(), entry), registry.end());
+    delete entry;
+  }
+  
+  
+  // Checks every expression of a crontab. An empty crontab is valid (no runs).
+  // On failure, 'error' says which expression and field failed, and why.
+  static bool Validate(const std::string& crontab, std::string* error = nullptr) {
+    std::string normalized = Normalize(crontab);
+    size_t pos = 0;
+    int index = 1;
+    
+    while (pos < normalized.size()) {
+      size_t bar = normalized.find(" | ", pos);
+      if (bar == std::string::npos) { bar = normalized.size(); }
+      std::string item = normalized.substr(pos, bar - pos);
+      pos = bar + 3;
+      
+      CronExpr expr;
+      std::string reason;
+      if (!CronExpr::Parse(item, expr, &reason)) {
+        if (error != nullptr) {
+          *error = "expression " + std::to_string(index) + " '" + item + "': " + reason;
+        }
+        return false;
+      }
+      index++;
+    }
+    return true;
+  }
+  
+  
+  // Trims and collapses whitespace, uppercases names, and joins expressions with " | ".
+  // Ex: " 0 0 6 * * mon-fri|0 0 8  * * sat " => "0 0 6 * * MON-FRI | 0 0 8 * * SAT"
+  static std::string Normalize(const std::string& crontab) {
+    std::string out;
+    std::stringstream pieces(crontab);
+    std::string piece;
+    
+    while (std::getline(pieces, piece, '|')) {
+      std::stringstream fields(piece);
+      std::string field, expr;
+      while (fields >> field) {
+        if (!expr.empty()) { expr += " "; }
+        expr += field;
+      }
+      if (expr.empty()) { continue; }
+      if (!out.empty()) { out += " | "; }
+      out += expr;
+    }
+    
+    std::transform(out.begin(), out.end(), out.begin(), ::toupper);
+    return out;
+  }
+  
+  
+  // First run strictly after 'ref' of any expression, ignoring exclusions.
+  std::time_t next(std::time_t ref) {
+    if (ref != cached_ref) {
+      cached_ref = ref;
+      cached_next = nextOf(ref, nullptr);
+    }
+    return cached_next;
+  }
+  
+  
+  // First run strictly after 'ref' of any expression, skipping excluded days.
+  std::time_t nextOf(std::time_t ref, const ExclusionCalendar* exclusions) const {
+    std::time_t out = 0;
+    for (auto& expr : exprs) {
+      std::time_t next = expr.next(ref, exclusions);
+      if (next != 0 && (out == 0 || next < out)) { out = next; }
+    }
+    return out;
+  }
+  
+}; // SharedCrontab struct
+
+
+// One source of runs for a timeline: a compiled crontab, and the days it skips.
+// Merge() combines any number of them into one time-sorted list of runs.
+struct TimelineSource {
+  const SharedCrontab       *crontab;
+  const ExclusionCalendar   *exclusions; // nullptr if none
+  
+  typedef std::pair<std::time_t, size_t> Run; // {time, source index}
+  
+  
+  // Returns the merged runs of 'sources' in [t1, t2), sorted by time, ties by source index.
+  // Each cron expression gets an incremental cursor, and the cursors are merged through
+  // a min-heap, so the cost is proportional to the number of runs returned, not to
+  // (sources x window). Sources sharing a crontab, with no exclusions, share cursors too.
+  //
+  // At most 'limit' runs are returned. If given, 'covered' is set to the end of the
+  // span the result is complete for: t2, or the time of the first run left out.
+  static std::vector<Run> Merge(const std::vector<TimelineSource>& sources, std::time_t t1, std::time_t t2, size_t limit, std::time_t* covered = nullptr) {
+    std::vector<Run> runs;
+    if (covered != nullptr) { *covered = t2; }
+    if (t2 <= t1) { return runs; }
+    
+    struct Cursor {
+      const CronExpr          *expr;
+      const ExclusionCalendar *exclusions;
+      std::vector<size_t>     indexes; // source indexes
+    };
+    std::vector<Cursor> cursors;
+    std::map<const SharedCrontab*, size_t> shared_cursors; // first cursor of each shared crontab
+    
+    // Min-heap of {next-time, cursor-index}.
+    typedef std::pair<std::time_t, size_t> HeapItem;
+    std::priority_queue<HeapItem, std::vector<HeapItem>, std::greater<HeapItem>> heap;
+    
+    for (size_t i = 0; i < sources.size(); i++) {
+      const SharedCrontab *entry = sources[i].crontab;
+      const ExclusionCalendar *exclusions = sources[i].exclusions;
+      if (entry == nullptr) { continue; }
+      
+      if (exclusions == nullptr) {
+        auto found = shared_cursors.find(entry);
+        if (found != shared_cursors.end()) {
+          for (size_t c = found->second; c < found->second + entry->exprs.size(); c++) {
+            cursors[c].indexes.push_back(i);
+          }
+          continue;
+        }
+        shared_cursors[entry] = cursors.size();
+      }
+      
+      for (auto& expr : entry->exprs) {
+        heap.push(HeapItem(expr.next(t1 - 1, exclusions), cursors.size())); // t1 is inclusive
+        cursors.push_back({&expr, exclusions, {i}});
+      }
+    }
+    
+    // Last emitted time per source, so overlapping expressions
+    // within one source don't produce duplicate runs.
+    std::vector<std::time_t> last(sources.size(), 0);
+    
+    while (!heap.empty()) {
+      HeapItem top = heap.top();
+      heap.pop();
+      std::time_t time = top.first;
+      Cursor& c = cursors[top.second];
+      
+      if (time >= t2 || time <= 0) { continue; }
+      
+      for (size_t index : c.indexes) {
+        if (last[index] == time) { continue; }
+        if (runs.size() >= limit) {
+          // Drops the partial instant, so [t1, covered) is complete.
+          while (!runs.empty() && runs.back().first == time) { runs.pop_back(); }
+          if (covered != nullptr) { *covered = time; }
+          std::sort(runs.begin(), runs.end());
+          return runs;
+        }
+        runs.push_back({time, index});
+        last[index] = time;
+      }
+      
+      heap.push(HeapItem(c.expr->next(time, c.exclusions), top.second));
+    }
+    
+    // Orders ties by source index.
+    std::sort(runs.begin(), runs.end());
+    return runs;
+  }
+  
+}; // TimelineSource struct
+
+
+// Timer delay (ms) to wake up for a run due at UTC time 'due' (seconds), when the clock
+// reads 'now_ms'. Never negative, and capped at 'max_ms', so a long wait is re-checked
+// against the clock in steps (timers run on millis(), which drifts from the clock).
+inline int64_t DeadlineDelayMs(std::time_t due, int64_t now_ms, int64_t max_ms) {
+  int64_t delay_ms = (int64_t) due * 1000 - now_ms;
+  return std::max((int64_t) 0, std::min(delay_ms, max_ms));
+}
+
+
+// Decisions for the timer that fires a run at its due time: when to fire, and when to
+// (re-)arm. The timer runs on millis(), the due time is on the wall clock. They are tied
+// by an anchor (wall-clock ms minus millis) taken when the timer is armed, so a clock
+// step (time sync) shows up as the anchor moving. Schedule owns the actual timer.
+struct DeadlineTimer {
+  // Longest single wait. Longer waits are re-armed in steps,
+  // so clock drift against millis() can't accumulate.
+  static constexpr int64_t MAX_MS = 60000;
+  // Wall-clock step (vs millis) that counts as a time sync and re-arms the timer.
+  static constexpr int64_t CLOCK_JUMP_MS = 250;
+  
+  std::time_t   armed_due = 0;  // due time the timer was armed for
+  int64_t       anchor_ms = 0;  // wall-clock ms minus millis, when armed
+  
+  
+  // Is a run due at 'due' (0 = none) due by wall-clock 'now_ms'? Due at the exact second.
+  static bool Due(std::time_t due, int64_t now_ms) {
+    return due != 0 && now_ms >= (int64_t) due * 1000;
+  }
+  
+  
+  // Records an arming for 'due', and returns the timer delay in ms,
+  // or -1 if there is nothing to wait for.
+  int64_t arm(std::time_t due, int64_t now_ms, uint32_t millis_now) {
+    armed_due = due;
+    anchor_ms = now_ms - (int64_t) millis_now;
+    if (due == 0) { return -1; }
+    return DeadlineDelayMs(due, now_ms, MAX_MS);
+  }
+  
+  
+  // Checked on every loop: must the timer be re-armed, because the due time changed,
+  // or the wall clock stepped against millis() since it was armed?
+  // (millis() wrapping also moves the anchor, which just re-arms once.)
+  bool needsRearm(std::time_t due, int64_t now_ms, uint32_t millis_now) const {
+    int64_t step = (now_ms - (int64_t) millis_now) - anchor_ms;
+    return due != armed_due || step > CLOCK_JUMP_MS || step < -CLOCK_JUMP_MS;
+  }
+  
+}; // DeadlineTimer struct
+
+
+// Refills an NVS write-budget token bucket ('budget' writes per hour) after 'elapsed_ms',
+// capped at 'budget'. In float, since the time between writes can be hours, and
+// elapsed_ms * budget would overflow 32 bits.
+inline float RefillTokens(float tokens, uint32_t elapsed_ms, uint32_t budget) {
+  return std::min((float) budget, tokens + (float) elapsed_ms * budget / 3600000.0f);
+}
+
+
+} // dynamic_cron namespace
+} // esphome namespace
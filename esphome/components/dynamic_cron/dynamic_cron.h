@@ -2,18 +2,20 @@
 
 #include "esphome.h"
 #include "esphome/core/component.h"
-#include <croncpp.h>
 #include <iostream>
 #include <iomanip>
 #include <string>
 // #include <ctime> do we need this for stringToTime() ?
-#include <regex>
 #include <vector>
 #include <map>
 #include <algorithm>
 #include <Preferences.h>
 #include <time.h>
+#include <sys/time.h>
 
+#include "cron_core.h"
+
+#include "esphome/components/sensor/sensor.h"
 #include "esphome/components/switch/switch.h"
 #include "esphome/components/text_sensor/text_sensor.h"
 #include "esphome/components/text/text.h"
@@ -25,6 +27,14 @@ namespace dynamic_cron {
 static const char *TAG = "dynamic_cron";
 static int TIMESTAMP;
 
+// Number of firing records kept in RAM per schedule.
+// Override with a build flag: -DDYNAMIC_CRON_HISTORY_SIZE=<n>
+#ifndef DYNAMIC_CRON_HISTORY_SIZE
+#define DYNAMIC_CRON_HISTORY_SIZE 16
+#endif
+static_assert(DYNAMIC_CRON_HISTORY_SIZE > 0 && DYNAMIC_CRON_HISTORY_SIZE <= 255,
+              "DYNAMIC_CRON_HISTORY_SIZE must be 1-255 (history index is uint8_t)");
+
 // Forward declarations that just barely work, given single-file code structure.
 // To push the sub-component building entirely into c++, we would need to separate
 // the code into .h and .cpp files. Otherwise we get bad-use-of-incomplete-class
@@ -35,6 +45,55 @@ class CrontabTextField;
 class BypassSwitch;
 class IgnoreMissedSwitch;
 class CronNextSensor;
+class CronNextTimestampSensor;
+class CronCountdownSensor;
+class CronHistorySensor;
+class NvsCounterSensor;
+class ExclusionsTextField;
+class CrontabErrorSensor;
+
+
+// Counters of NVS (Preferences) activity, kept per schedule and globally.
+struct NvsStats {
+  uint32_t  opens = 0;
+  uint32_t  reads = 0;
+  uint32_t  writes = 0;
+  uint32_t  bytes = 0;     // bytes written
+  uint32_t  deferred = 0;  // cronnext values held back by the write budget
+  uint32_t  clears = 0;    // namespace clears (not counted as writes, or against the budget)
+};
+
+
+// One firing of a schedule's target action. Packed to 8 bytes, so the
+// per-schedule ring buffer is a small fixed array with no heap use.
+struct FireRecord {
+  uint32_t  scheduled;  // cronnext at the time of firing (epoch seconds)
+  int16_t   late;       // actual minus scheduled time, in seconds (clamped)
+  uint8_t   result;     // 1 if the target action returned true
+  uint8_t   retries;    // prior false returns for this same scheduled time
+} __attribute__((packed));
+
+
+// One run of a schedule, as returned by Schedule::Timeline().
+struct Occurrence {
+  std::time_t   time;
+  Schedule      *schedule;
+};
+
+
+// Two runs whose [time, time + duration) intervals overlap.
+struct Conflict {
+  Occurrence    first;
+  Occurrence    second;
+};
+
+
+// A span in which at least 'threshold' runs start within 'window' seconds of each other.
+struct Burst {
+  std::time_t   start;  // time of first run in the burst
+  std::time_t   end;    // time of last run in the burst
+  size_t        count;
+};
 
 
 class Schedule : public Component {
@@ -52,18 +111,50 @@ private:
   // Basic data points.
   const char    *schedule_name;
   const char    *schedule_id;
-  std::string   crontab;
+  SharedCrontab *crontab_entry;        // interned crontab, nullptr if empty
+  std::string   crontab_error;         // why the last crontab edit was rejected, or ""
+  uint32_t      crontab_error_revision;
   std::time_t   cronnext;
   bool          bypass;
   bool          ignore_missed;
   std::string   id_hash;
   std::time_t   previous;
   bool          setup_complete;
+  DeadlineTimer deadline;          // when to fire, and when to re-arm the "deadline" timeout
   
   String        crontab_default;
   bool          bypass_default;
   bool          ignore_missed_default;
   bool          clear_prefs; // Clears prefs at first boot after flash.
+  ExclusionCalendar exclusions;
+  std::string   exclusions_default;
+  uint32_t      exclusions_revision;
+  uint32_t      duration;    // Expected run length in seconds, used for conflict detection.
+  
+  // Firing history ring buffer. Oldest record is at history_head,
+  // when the buffer is full. history_revision changes on every update,
+  // so consumers can format lazily.
+  FireRecord    history[DYNAMIC_CRON_HISTORY_SIZE];
+  uint8_t       history_head;
+  uint8_t       history_count;
+  uint32_t      history_revision;
+  bool          history_dirty;
+  uint32_t      history_saved_ms;
+  
+  // Values as last loaded from / saved to prefs, so savePrefs()
+  // can detect changes without opening NVS.
+  SharedCrontab *saved_crontab_entry;  // holds its own reference
+  std::time_t   saved_cronnext;
+  bool          saved_bypass;
+  bool          saved_ignore_missed;
+  ExclusionCalendar saved_exclusions;
+  
+  // NVS accounting and write budget (token bucket, refilled continuously).
+  NvsStats      nvs_stats;
+  uint32_t      nvs_write_budget;  // writes per hour, 0 = unlimited
+  float         nvs_tokens;
+  uint32_t      nvs_tokens_ms;
+  std::time_t   deferred_cronnext; // latest cronnext held back by the budget, or 0
   
   // Lamba for call to target action.
   // Can also receive basic function pointer.
@@ -79,8 +170,14 @@ public:
   BypassSwitch        *bypass_switch;
   IgnoreMissedSwitch  *ignore_missed_switch;
   CronNextSensor      *cron_next_sensor;
+  CronNextTimestampSensor *cron_next_timestamp_sensor;
+  CronCountdownSensor *cron_countdown_sensor;
+  CronHistorySensor   *cron_history_sensor;
+  ExclusionsTextField *exclusions_text_field;
+  CrontabErrorSensor  *crontab_error_sensor;
   
   double              loop_interval; // seconds
+  uint32_t            history_checkpoint_interval; // seconds, 0 disables persistence
   
   // Esphome Component overrides
   void setup() override {
@@ -93,10 +190,18 @@ public:
       }
       
       setup_complete = true;
+      armDeadline();
     }
   }
   
   void loop() override {
+    // Re-arms the deadline timer if cronnext changed, or if the wall clock jumped (time sync).
+    if (setup_complete && deadline.needsRearm(cronnext, nowMs(), millis())) {
+      armDeadline();
+    }
+    
+    // The periodic check is still the fallback for firing
+    // (and the retry path, when the target action returns false).
     std::time_t now = std::time(NULL);
     double seconds = difftime(now, previous);
     
@@ -116,6 +221,18 @@ public:
   
   void dump_config() override {
     ESP_LOGCONFIG(TAG, "Dynamic Cron Schedule");
+    ESP_LOGCONFIG(TAG, "  NVS write budget: %u/hour", nvs_write_budget);
+  }
+  
+  // Saves deferred cronnext and unsaved history before a controlled reboot,
+  // regardless of write budget.
+  void on_shutdown() override {
+    if (setup_complete) {
+      savePrefs(true);
+    }
+    if (history_dirty && history_checkpoint_interval > 0) {
+      saveHistory();
+    }
   }
   
   
@@ -131,7 +248,9 @@ public:
   ) :
     schedule_name(_name),
     schedule_id(_id),
-    crontab(""),
+    crontab_entry(nullptr),
+    crontab_error(""),
+    crontab_error_revision(0),
     crontab_default(""),
     cronnext(0),
     bypass(false),
@@ -140,9 +259,26 @@ public:
     ignore_missed_default(false),
     target_action_fptr(_target_action_fptr),
     loop_interval(5),
+    history_checkpoint_interval(3600),
     id_hash(""),
     setup_complete(false),
-    clear_prefs(false)
+    clear_prefs(false),
+    duration(0),
+    exclusions_default(""),
+    exclusions_revision(0),
+    history_head(0),
+    history_count(0),
+    history_revision(0),
+    history_dirty(false),
+    history_saved_ms(0),
+    saved_crontab_entry(nullptr),
+    saved_cronnext(0),
+    saved_bypass(false),
+    saved_ignore_missed(false),
+    nvs_write_budget(0),
+    nvs_tokens(0),
+    nvs_tokens_ms(0),
+    deferred_cronnext(0)
   {
     ESP_LOGD("schedules", "Initializing Schedule object '%s'", schedule_id);
     id_hash = GetHash(schedule_id);
@@ -184,6 +320,97 @@ public:
   }
   
   
+  // Returns the merged runs of all active schedules in [t1, t2), sorted by time
+  // (ties in Schedules() order). See TimelineSource::Merge().
+  //
+  // At most 'limit' runs are returned. If given, 'covered' is set to the end of the
+  // span the result is complete for: t2, or the time of the first run left out,
+  // so a caller can tell the result was cut, and continue from there.
+  static std::vector<Occurrence> Timeline(std::time_t t1, std::time_t t2, size_t limit = 256, std::time_t* covered = nullptr) {
+    std::vector<TimelineSource> sources;
+    for (auto s : Schedules()) {
+      const SharedCrontab *entry = s->bypass ? nullptr : s->crontab_entry;
+      sources.push_back({entry, s->exclusions.empty() ? nullptr : &s->exclusions});
+    }
+    
+    std::vector<Occurrence> out;
+    for (auto& run : TimelineSource::Merge(sources, t1, t2, limit, covered)) {
+      out.push_back({run.first, Schedules()[run.second]});
+    }
+    return out;
+  }
+  
+  
+  // Returns pairs of runs from different schedules, whose [time, time + duration)
+  // intervals overlap, where the later run starts in [t1, t2). Runs that started
+  // before t1 and are still going count too. Schedules with no duration are treated
+  // as instantaneous, so they only conflict with a run in progress.
+  // 'limit' and 'covered' are as in Timeline() (runs from before t1 count toward 'limit').
+  static std::vector<Conflict> Conflicts(std::time_t t1, std::time_t t2, size_t limit = 256, std::time_t* covered = nullptr) {
+    std::vector<Conflict> out;
+    std::vector<Occurrence> active;
+    
+    // Looks back far enough to catch runs still going at t1.
+    std::time_t lookback = 0;
+    for (auto s : Schedules()) {
+      lookback = std::max(lookback, (std::time_t) s->duration);
+    }
+    
+    for (auto& occ : Timeline(t1 - lookback, t2, limit, covered)) {
+      // Drops runs that have ended by now.
+      active.erase(
+        std::remove_if(active.begin(), active.end(), [&occ](const Occurrence& a) {
+          return (a.time + (std::time_t) a.schedule->duration) <= occ.time && a.time != occ.time;
+        }),
+        active.end()
+      );
+      
+      if (occ.time >= t1) {
+        for (auto& a : active) {
+          if (a.schedule != occ.schedule) {
+            out.push_back({a, occ});
+          }
+        }
+      }
+      active.push_back(occ);
+    }
+    
+    return out;
+  }
+  
+  
+  // Returns spans in [t1, t2) where at least 'threshold' runs (of any schedule)
+  // start within 'window' seconds. Overlapping spans are merged into one.
+  // 'limit' and 'covered' are as in Timeline().
+  static std::vector<Burst> Bursts(std::time_t t1, std::time_t t2, std::time_t window, size_t threshold, size_t limit = 256, std::time_t* covered = nullptr) {
+    std::vector<Burst> out;
+    if (covered != nullptr) { *covered = t2; }
+    if (threshold == 0) { return out; }
+    std::vector<Occurrence> runs = Timeline(t1, t2, limit, covered);
+    
+    size_t first = 0;
+    size_t burst_first = 0; // index of the first run of out.back()
+    for (size_t i = 0; i < runs.size(); i++) {
+      while (runs[i].time - runs[first].time > window) { first++; }
+      size_t count = i - first + 1;
+      if (count < threshold) { continue; }
+      
+      if (!out.empty() && out.back().end >= runs[first].time) {
+        // Extends the current burst up to this run. Counts every run in the span,
+        // including runs in between that didn't reach the threshold on their own.
+        out.back().end = runs[i].time;
+        out.back().count = i - burst_first + 1;
+      }
+      else {
+        out.push_back({runs[first].time, runs[i].time, count});
+        burst_first = first;
+      }
+    }
+    
+    return out;
+  }
+
+
   static std::string GetHash(std::string input, int len = 15) {
     
     // Create a hash
@@ -218,7 +445,7 @@ public:
   // Returns multiple sequential cronNextCalc results, as a map of {time_t, cron-next-string}.
   std::map<std::time_t, std::string> cronNextMap(int count = 1, std::string _crontab = "", std::time_t ref_time = 0) {
 
-    if (_crontab == "") { _crontab = crontab; }
+    if (_crontab == "") { _crontab = getCrontab(); }
     if (ref_time == 0) { ref_time = timeNow(); }
 
     std::map<std::time_t, std::string> out {};
@@ -243,10 +470,10 @@ public:
     std::time_t now = timeNow();
     bool out = false;
     
-    if (crontab == "" || cronnext == 0 || bypass) {
+    if (crontab_entry == nullptr || cronnext == 0 || bypass) {
       out = false;
     } else {
-      out = (std::difftime(cronnext, now) < 0);
+      out = DeadlineTimer::Due(cronnext, (int64_t) now * 1000);
     }
     
     //ESP_LOGD("schedules", "cronNextExpired() cronnext, now: %s, %s", timeToString(cronnext).c_str(), timeToString(now).c_str());
@@ -268,7 +495,7 @@ public:
     if (timeIsValid()) {
       // TODO to handle custom input:
       // if input is valid-time, ! bypass, > now, < cronNextCalc(), then cronnext=input;
-      if (crontab == "" || bypass) {
+      if (crontab_entry == nullptr || bypass) {
         cronnext = 0;
       }
       else {
@@ -303,17 +530,82 @@ public:
   // Getter for crontab
   //std::string getCrontab() { // returns copy of crontab.
   // This returns a reference to crontab and is more efficient.
+  // The crontab text is the normalized text of the shared (interned) crontab.
   const std::string& getCrontab() const {
-    return crontab;
+    static const std::string empty;
+    return (crontab_entry != nullptr) ? crontab_entry->text : empty;
   }
 
 
   // Sets crontab with given string.
+  // An invalid crontab is rejected (see getCrontabError()), and the current one is kept.
   std::string setCrontab(std::string str) {
+    std::string error;
+    if (!SharedCrontab::Validate(str, &error)) {
+      ESP_LOGE("schedules", "Rejected crontab for '%s' %s: %s", schedule_id, str.c_str(), error.c_str());
+      setCrontabError(error);
+      return getCrontab();
+    }
+    
     ESP_LOGD("schedules", "Setting crontab for '%s' %s", schedule_id, str.c_str());
-    crontab = str;
+    setCrontabError("");
+    assignCrontab(str);
     setCronNext();
-    return crontab;
+    return getCrontab();
+  }
+  
+  
+  // Why the last crontab edit was rejected, or "" if it was accepted.
+  const std::string& getCrontabError() const {
+    return crontab_error;
+  }
+  
+  
+  // Changes whenever the crontab error changes.
+  uint32_t getCrontabErrorRevision() const {
+    return crontab_error_revision;
+  }
+
+
+  // Sets excluded days from a list of 'MM-DD' dates and 'MM-DD..MM-DD' ranges.
+  // Keeps the current exclusions, if the list is invalid.
+  bool setExclusions(const std::string& str) {
+    ExclusionCalendar cal;
+    if (!ExclusionCalendar::Parse(str, cal)) {
+      ESP_LOGE("schedules", "Invalid exclusions for '%s': %s", schedule_id, str.c_str());
+      return false;
+    }
+    ESP_LOGD("schedules", "Setting exclusions for '%s' %s", schedule_id, cal.toString().c_str());
+    exclusions = cal;
+    exclusions_revision++;
+    setCronNext();
+    return true;
+  }
+  
+  
+  // Sets a single day excluded (or not), ex. from a rain sensor.
+  void setExcluded(unsigned month, unsigned day, bool val = true) {
+    int index = ExclusionCalendar::DayIndex(month, day);
+    if (index < 0) { return; }
+    exclusions.set(index, val);
+    exclusions_revision++;
+    setCronNext();
+  }
+  
+  
+  const ExclusionCalendar& getExclusions() const {
+    return exclusions;
+  }
+  
+  
+  std::string getExclusionsString() const {
+    return exclusions.toString();
+  }
+  
+  
+  // Changes whenever exclusions are set.
+  uint32_t getExclusionsRevision() const {
+    return exclusions_revision;
   }
 
 
@@ -370,9 +662,91 @@ public:
   }
   
   
+  void setExclusionsDefault(std::string val) {
+    exclusions_default = val;
+  }
+  
+  
   void setClearPrefs(bool val) {
     clear_prefs = val;
   }
+  
+  
+  void setDuration(uint32_t val) {
+    duration = val;
+  }
+  
+  
+  uint32_t getDuration() const {
+    return duration;
+  }
+  
+  
+  void setNvsWriteBudget(uint32_t val) {
+    nvs_write_budget = val;
+    nvs_tokens = val;
+    nvs_tokens_ms = millis();
+  }
+  
+  
+  const NvsStats& getNvsStats() const {
+    return nvs_stats;
+  }
+  
+  
+  // NVS counters for all schedules together.
+  static NvsStats& GlobalNvsStats() {
+    static NvsStats stats;
+    return stats;
+  }
+  
+  
+  void setHistoryCheckpointInterval(uint32_t val) {
+    history_checkpoint_interval = val;
+  }
+  
+  
+  // Number of firing records currently held.
+  size_t historySize() const {
+    return history_count;
+  }
+  
+  
+  // Gets a firing record, where 0 is the most recent.
+  const FireRecord& historyAt(size_t index) const {
+    size_t newest = (history_head + history_count - 1) % DYNAMIC_CRON_HISTORY_SIZE;
+    return history[(newest + DYNAMIC_CRON_HISTORY_SIZE - index) % DYNAMIC_CRON_HISTORY_SIZE];
+  }
+  
+  
+  // Changes whenever a record is added or updated.
+  uint32_t getHistoryRevision() const {
+    return history_revision;
+  }
+  
+  
+  // Builds human-readable firing history, most recent first, without exceeding max_len.
+  // Ex: "2024-10-05 06:00:00 +2s ok; 2024-10-04 06:00:00 +0s fail r3"
+  std::string historyString(size_t max_len = 255) {
+    std::string out;
+    for (size_t i = 0; i < history_count; i++) {
+      const FireRecord& rec = historyAt(i);
+      char entry[48];
+      snprintf(entry, sizeof(entry), "%s %+ds %s",
+        timeToString((std::time_t) rec.scheduled).c_str(),
+        rec.late,
+        rec.result ? "ok" : "fail"
+      );
+      std::string item(entry);
+      if (rec.retries > 0) {
+        item += " r" + std::to_string(rec.retries);
+      }
+      if (!out.empty()) { item = "; " + item; }
+      if (out.size() + item.size() > max_len) { break; }
+      out += item;
+    }
+    return out;
+  }
 
 
   // Builds human-readable string from time_t.
@@ -421,8 +795,9 @@ public:
     const char *idhash = id_hash.c_str();
     ESP_LOGD("schedules", "Opening Preferences '%s' (%s) for initialization", schedule_name, idhash);
     
-    prefs.begin(idhash, false); // open read-write
+    nvsBegin(false); // open read-write
     int _initialized = prefs.getInt("initialized", 0);
+    nvsRead();
     // ESP_LOGD("schedules", "Preferences '%s' (%s) is comparing TIMESTAMP '%i' with prefs.initialized '%i'",
     //           schedule_name,
     //           idhash,
@@ -438,7 +813,8 @@ public:
       return false;
     }
     else if (clear_prefs == true || force == true) {
-      bool rslt = prefs.clear() && prefs.putInt("initialized", TIMESTAMP);
+      bool rslt = nvsClear();
+      rslt = rslt && nvsWrite(prefs.putInt("initialized", TIMESTAMP));
       prefs.end();
       if (rslt) {
         ESP_LOGD("schedules", "Initialized Preferences '%s' (%s) with stamp '%i'", schedule_name, idhash, TIMESTAMP);
@@ -466,36 +842,68 @@ private:
     const char *idhash = id_hash.c_str();
     
     ESP_LOGD("schedules", "Opening Preferences '%s' (%s) for reading", schedule_name, idhash);
-    prefs.begin(idhash, true); // open read-only
+    nvsBegin(true); // open read-only
     
     size_t number_free_entries = prefs.freeEntries();
     ESP_LOGD("schedules", "There are %u free entries available in the namespace table '%s'", number_free_entries, idhash);
 
     //ESP_LOGD("schedules", "Loading crontab from prefs '%s', with potential default '%s'", schedule_name, crontab_default.c_str());
     ESP_LOGD("schedules", "Loading crontab from prefs '%s'", schedule_name);
-    crontab = prefs.getString("crontab", crontab_default).c_str();
+    std::string loaded_crontab(prefs.getString("crontab", crontab_default).c_str());
+    std::string loaded_error;
+    if (!SharedCrontab::Validate(loaded_crontab, &loaded_error)) {
+      ESP_LOGE("schedules", "Loaded crontab for '%s' is invalid: %s", schedule_name, loaded_error.c_str());
+      setCrontabError(loaded_error);
+    }
+    assignCrontab(loaded_crontab);
+    SharedCrontab::Release(saved_crontab_entry);
+    saved_crontab_entry = SharedCrontab::Retain(crontab_entry);
+    nvsRead();
 
     ESP_LOGD("schedules", "Loading ignore_missed from prefs '%s'", schedule_name);
     ignore_missed = prefs.getBool("ignore_missed", ignore_missed_default);
+    saved_ignore_missed = ignore_missed;
+    nvsRead();
 
     ESP_LOGD("schedules", "Loading bypass from prefs '%s'", schedule_name);
     bypass = prefs.getBool("bypass", bypass_default);
+    saved_bypass = bypass;
+    nvsRead();
 
     // This has to load after all the others, since we may need to call setCronNext(),
     // which depends on the others being loaded.
+    ESP_LOGD("schedules", "Loading exclusions from prefs '%s'", schedule_name);
+    size_t exclusions_len = prefs.getBytesLength("exclusions");
+    nvsRead();
+    if (exclusions_len == sizeof(exclusions.bits)) {
+      prefs.getBytes("exclusions", exclusions.bits, sizeof(exclusions.bits));
+      nvsRead();
+    }
+    else if (!ExclusionCalendar::Parse(exclusions_default, exclusions)) {
+      ESP_LOGE("schedules", "Invalid default exclusions '%s' for '%s', none applied", exclusions_default.c_str(), schedule_name);
+    }
+    saved_exclusions = exclusions;
+    exclusions_revision++;
+
+    saved_cronnext = (std::time_t) prefs.getDouble("cronnext", 0);
+    nvsRead();
     if (!ignore_missed) {
       ESP_LOGD("schedules", "Loading cronnext from prefs '%s'", schedule_name);
-      cronnext = (std::time_t) prefs.getDouble("cronnext", 0);
+      cronnext = saved_cronnext;
     } else {
       // timeNow() might not be valid yet, but we'll try here anyway.
       // Otherwise, we have a hook in the cron loop that will pick this up.
       //setCronNext();
       cronnext = 0;
     }
+    
+    if (history_checkpoint_interval > 0) {
+      loadHistory();
+    }
 
     prefs.end(); // close
 
-    ESP_LOGD("schedules", "Schedule '%s' loaded crontab: %s", schedule_name, crontab.c_str());
+    ESP_LOGD("schedules", "Schedule '%s' loaded crontab: %s", schedule_name, getCrontab().c_str());
     ESP_LOGD("schedules", "Schedule '%s' loaded ignore_missed: %i", schedule_name, ignore_missed);
     if (!ignore_missed) {
       ESP_LOGD("schedules", "Schedule '%s' loaded cronnext: %d (%s)", schedule_name, cronnext, timeToString(cronnext).c_str());
@@ -506,41 +914,67 @@ private:
 
 
   // Saves persistent data to esp32 nvs.
-  void savePrefs() {
+  // Changes are detected against the last saved values, so NVS is only opened to write.
+  // When over the write budget, cronnext writes are deferred (and coalesced, since only
+  // the latest cronnext is written once budget is available). Setting changes made by
+  // the user are always written. 'force' ignores the budget.
+  void savePrefs(bool force = false) {
     const char *idhash = id_hash.c_str();
 
-    //ESP_LOGD("schedules", "Opening Preferences '%s' (%s) to check for changed values", schedule_name, idhash);
-    prefs.begin(idhash, true); // open read-only
-    bool crontab_changed = (crontab != std::string(prefs.getString("crontab", crontab_default).c_str()));
-    bool ignore_missed_changed = (ignore_missed != prefs.getBool("ignore_missed", ignore_missed_default));
-    bool cronnext_changed = (cronnext != (std::time_t) prefs.getDouble("cronnext", 0) && !ignore_missed);
-    bool bypass_changed = (bypass != prefs.getBool("bypass", bypass_default));
-    prefs.end(); // close
+    bool crontab_changed = (crontab_entry != saved_crontab_entry);
+    bool ignore_missed_changed = (ignore_missed != saved_ignore_missed);
+    bool cronnext_changed = (cronnext != saved_cronnext && !ignore_missed);
+    bool bypass_changed = (bypass != saved_bypass);
+    bool exclusions_changed = (std::memcmp(exclusions.bits, saved_exclusions.bits, sizeof(exclusions.bits)) != 0);
+    
+    if (cronnext_changed && !force && !nvsBudgetAvailable()) {
+      if (cronnext != deferred_cronnext) {
+        if (deferred_cronnext == 0) {
+          ESP_LOGW("schedules", "NVS write budget exceeded for '%s', deferring cronnext writes", schedule_name);
+        }
+        deferred_cronnext = cronnext;
+        nvs_stats.deferred++;
+        GlobalNvsStats().deferred++;
+      }
+      cronnext_changed = false;
+    }
 
     // If any changes, then open prefs for writing.
-    if (crontab_changed || ignore_missed_changed || cronnext_changed || bypass_changed) {
+    if (crontab_changed || ignore_missed_changed || cronnext_changed || bypass_changed || exclusions_changed) {
 
       ESP_LOGD("schedules", "Opening Preferences %s (%s) for writing", schedule_name, idhash);
-      prefs.begin(idhash, false); // open as read/write
+      nvsBegin(false); // open as read/write
 
       if (crontab_changed) {
-        ESP_LOGD("schedules", "Saving crontab to prefs '%s' (%s)", schedule_name, crontab.c_str());
-        prefs.putString("crontab", String(crontab.c_str()));
+        ESP_LOGD("schedules", "Saving crontab to prefs '%s' (%s)", schedule_name, getCrontab().c_str());
+        nvsWrite(prefs.putString("crontab", String(getCrontab().c_str())));
+        SharedCrontab::Release(saved_crontab_entry);
+        saved_crontab_entry = SharedCrontab::Retain(crontab_entry);
       }
 
       if (ignore_missed_changed) {
         ESP_LOGD("schedules", "Saving ignore_missed to prefs '%s' (%d)", schedule_name, ignore_missed);
-        prefs.putBool("ignore_missed", ignore_missed);
+        nvsWrite(prefs.putBool("ignore_missed", ignore_missed));
+        saved_ignore_missed = ignore_missed;
       }
 
       if (cronnext_changed) {
         ESP_LOGD("schedules", "Saving cronnext to prefs '%s' (%i)", schedule_name, cronnext);
-        prefs.putDouble("cronnext", cronnext);
+        nvsWrite(prefs.putDouble("cronnext", cronnext));
+        saved_cronnext = cronnext;
+        deferred_cronnext = 0;
       }
 
       if (bypass_changed) {
         ESP_LOGD("schedules", "Saving bypass to prefs '%s' (%d)", schedule_name, bypass);
-        prefs.putBool("bypass", bypass);
+        nvsWrite(prefs.putBool("bypass", bypass));
+        saved_bypass = bypass;
+      }
+
+      if (exclusions_changed) {
+        ESP_LOGD("schedules", "Saving exclusions to prefs '%s' (%s)", schedule_name, exclusions.toString().c_str());
+        nvsWrite(prefs.putBytes("exclusions", exclusions.bits, sizeof(exclusions.bits)));
+        saved_exclusions = exclusions;
       }
 
       prefs.end();
@@ -549,6 +983,188 @@ private:
   } // savePrefs()
 
 
+  // Adds a firing record to the ring buffer. Repeated attempts at the same
+  // scheduled time (after the target action returned false) update the
+  // last record in place, rather than flooding the buffer.
+  void recordFire(std::time_t scheduled, std::time_t actual, bool result) {
+    double late = std::difftime(actual, scheduled);
+    late = std::max(-32768.0, std::min(32767.0, late));
+    
+    if (history_count > 0) {
+      FireRecord& last = history[(history_head + history_count - 1) % DYNAMIC_CRON_HISTORY_SIZE];
+      if (last.scheduled == (uint32_t) scheduled && last.result == 0) {
+        last.late = (int16_t) late;
+        last.result = result;
+        if (last.retries < 255) { last.retries++; }
+        history_revision++;
+        history_dirty = true;
+        return;
+      }
+    }
+    
+    FireRecord rec;
+    rec.scheduled = (uint32_t) scheduled;
+    rec.late = (int16_t) late;
+    rec.result = result;
+    rec.retries = 0;
+    
+    if (history_count < DYNAMIC_CRON_HISTORY_SIZE) {
+      history[(history_head + history_count) % DYNAMIC_CRON_HISTORY_SIZE] = rec;
+      history_count++;
+    } else {
+      history[history_head] = rec;
+      history_head = (history_head + 1) % DYNAMIC_CRON_HISTORY_SIZE;
+    }
+    history_revision++;
+    history_dirty = true;
+  }
+  
+  
+  // Opens this schedule's prefs namespace, counting the open.
+  void nvsBegin(bool read_only) {
+    prefs.begin(id_hash.c_str(), read_only);
+    nvs_stats.opens++;
+    GlobalNvsStats().opens++;
+  }
+  
+  
+  // Counts one NVS read.
+  void nvsRead() {
+    nvs_stats.reads++;
+    GlobalNvsStats().reads++;
+  }
+  
+  
+  // Clears this schedule's prefs namespace, counting the clear.
+  // Only done at (re)initialization, so it doesn't take from the write budget.
+  bool nvsClear() {
+    nvs_stats.clears++;
+    GlobalNvsStats().clears++;
+    return prefs.clear();
+  }
+  
+  
+  // Counts one NVS write of 'bytes' (the return value of a Preferences put call)
+  // and takes it from the write budget. Returns false if nothing was written.
+  bool nvsWrite(size_t bytes) {
+    nvs_stats.writes++;
+    nvs_stats.bytes += bytes;
+    GlobalNvsStats().writes++;
+    GlobalNvsStats().bytes += bytes;
+    if (nvs_write_budget > 0) {
+      nvsBudgetAvailable(); // refills
+      nvs_tokens = std::max(0.0f, nvs_tokens - 1);
+    }
+    return bytes > 0;
+  }
+  
+  
+  // Is there budget left for a write? Refills the bucket first.
+  bool nvsBudgetAvailable() {
+    if (nvs_write_budget == 0) { return true; }
+    uint32_t now = millis();
+    nvs_tokens = RefillTokens(nvs_tokens, now - nvs_tokens_ms, nvs_write_budget);
+    nvs_tokens_ms = now;
+    return nvs_tokens >= 1;
+  }
+  
+  
+  // Loads firing history blob (oldest record first) from esp32 nvs.
+  // Expects prefs to be open already.
+  // The whole blob is read, since it may hold more records than fit now
+  // (if DYNAMIC_CRON_HISTORY_SIZE was lowered). The newest records are kept.
+  void loadHistory() {
+    size_t len = prefs.getBytesLength("history");
+    nvsRead();
+    size_t stored = len / sizeof(FireRecord);
+    size_t count = 0;
+    
+    if (stored > 0 && len % sizeof(FireRecord) == 0) {
+      std::vector<FireRecord> blob(stored);
+      size_t read = prefs.getBytes("history", blob.data(), len);
+      nvsRead();
+      if (read == len) {
+        count = std::min(stored, (size_t) DYNAMIC_CRON_HISTORY_SIZE);
+        std::copy(blob.end() - count, blob.end(), history);
+      }
+      else {
+        ESP_LOGE("schedules", "Schedule '%s' could not read history blob (%u of %u bytes)", schedule_name, read, len);
+      }
+    }
+    
+    history_head = 0;
+    history_count = count;
+    history_revision++;
+    ESP_LOGD("schedules", "Schedule '%s' loaded %u history records", schedule_name, count);
+  }
+  
+  
+  // Saves firing history to esp32 nvs as a single blob, oldest record first.
+  void saveHistory() {
+    FireRecord ordered[DYNAMIC_CRON_HISTORY_SIZE];
+    for (size_t i = 0; i < history_count; i++) {
+      ordered[i] = historyAt(history_count - 1 - i);
+    }
+    
+    ESP_LOGD("schedules", "Saving %u history records to prefs '%s'", history_count, schedule_name);
+    nvsBegin(false); // open as read/write
+    nvsWrite(prefs.putBytes("history", ordered, history_count * sizeof(FireRecord)));
+    prefs.end();
+    
+    history_dirty = false;
+    history_saved_ms = millis();
+  }
+  
+  
+  // Checkpoints history, if it has changed and the checkpoint interval has passed.
+  void checkpointHistory() {
+    if (
+      history_dirty &&
+      history_checkpoint_interval > 0 &&
+      (millis() - history_saved_ms) >= history_checkpoint_interval * 1000UL &&
+      nvsBudgetAvailable()
+    ){
+      saveHistory();
+    }
+  }
+
+
+  // Current wall-clock time in milliseconds.
+  static int64_t nowMs() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+  }
+  
+  
+  // Arms a one-shot timer for the exact cronnext instant, so runs fire within
+  // a loop cycle of their due time, instead of up to loop_interval late.
+  void armDeadline() {
+    cancel_timeout("deadline");
+    int64_t delay_ms = deadline.arm(cronnext, nowMs(), millis());
+    
+    if (delay_ms < 0 || bypass || crontab_entry == nullptr) { return; }
+    set_timeout("deadline", (uint32_t) delay_ms, [this]() { onDeadline(); });
+  }
+  
+  
+  // Fires when due. Otherwise (long wait, or clock moved) re-arms.
+  void onDeadline() {
+    if (DeadlineTimer::Due(cronnext, nowMs())) {
+      std::time_t fired = cronnext;
+      cronLoop();
+      // If the target action returned false, cronnext is unchanged,
+      // and the loop_interval check takes over retries.
+      if (cronnext != fired) {
+        armDeadline();
+      }
+    }
+    else {
+      armDeadline();
+    }
+  }
+  
+  
   // Calls cronLoop() method of all items in Schedules.
   // Deprecated. Now we use esphome loop() method that's part of every Component instance.
   static void CronLooper() {
@@ -563,7 +1179,10 @@ private:
   // Calls savePrefs().
   void cronLoop() {
     if (timeIsValid() && cronNextExpired()) {
+      std::time_t scheduled = cronnext;
+      std::time_t actual = timeNow();
       bool result = target_action_fptr();
+      recordFire(scheduled, actual, result);
       if (result) {
         setCronNext();
       }
@@ -582,29 +1201,54 @@ private:
     //   setCronNext();
     // }
     savePrefs();
+    checkpointHistory();
   }
 
 
   // Gets next time_t, given cron expression(s) string in crontab.
   std::time_t cronNextCalc(std::string _crontab = "", std::time_t ref_time = 0) {
-    if (_crontab == ""){ _crontab = crontab; }
     if (ref_time == 0) { ref_time = timeNow(); }
 
-    // Returns 0 if no crontab or ref_time.
-    if (_crontab == "" || ref_time == 0) { return 0; }
-
-    // Requests sorted vector of nexts given crontab parsing string regex.
-    std::string regex_str = " *\\| *";
-    auto nexts = vectorOfNext(splitString(_crontab, regex_str), ref_time);
-
-    // Logs next-run for each crontab.
-    // for (auto& item: nexts)
-    // {
-    //   ESP_LOGD("schedules", "Sorted cron-next: %s", timeToString(item).c_str());
-    // }
+    // Returns 0 if no ref_time.
+    if (ref_time == 0) { return 0; }
 
-    // Returns first (soonest) time_t from vector-of-nexts.
-    return nexts[0];
+    if (_crontab == "" || _crontab == getCrontab()) {
+      return crontabNext(crontab_entry, ref_time);
+    }
+    
+    SharedCrontab *entry = SharedCrontab::Acquire(_crontab);
+    std::time_t out = crontabNext(entry, ref_time);
+    SharedCrontab::Release(entry);
+    return out;
+  }
+  
+  
+  // Next run of a shared crontab, with this schedule's exclusions.
+  // The shared (cached) result is used, unless it falls on an excluded day.
+  std::time_t crontabNext(SharedCrontab* entry, std::time_t ref_time) {
+    if (entry == nullptr) { return 0; }
+    
+    std::time_t out = entry->next(ref_time);
+    if (out != 0 && !exclusions.empty() && exclusions.excludedAt(out)) {
+      out = entry->nextOf(ref_time, &exclusions);
+    }
+    return out;
+  }
+  
+  
+  void setCrontabError(const std::string& error) {
+    if (error != crontab_error) {
+      crontab_error = error;
+      crontab_error_revision++;
+    }
+  }
+  
+  
+  // Points crontab_entry at the interned entry for the given text.
+  void assignCrontab(const std::string& str) {
+    SharedCrontab *entry = SharedCrontab::Acquire(str);
+    SharedCrontab::Release(crontab_entry);
+    crontab_entry = entry;
   }
 
 
@@ -630,47 +1274,6 @@ private:
     //ESP_LOGD("schedules", "now_tm.tm_year: %i", now_tm.tm_year);
     return ((now_tm.tm_year + 1900) > 2020);
   }
-
-
-  // Function to split std::string on regex.
-  std::vector<std::string> splitString(const std::string str, const std::string regex_str) {
-      std::regex regexz(regex_str);
-      return {std::sregex_token_iterator(str.begin(), str.end(), regexz, -1),
-              std::sregex_token_iterator()};
-  }
-
-
-  // Returns sorted vector of next time_t values for given vector-of-crontab-strings.
-  std::vector<std::time_t> vectorOfNext(std::vector<std::string> crontabs, std::time_t ref_time = 0) {
-    if (ref_time == 0) { ref_time = timeNow(); }
-    std::time_t _ref_time = ref_time;
-    std::vector<std::time_t> start_times;
-
-    // Adds seconds to ref_time, just to make sure it's ahead of input ref_time.
-    // To do that, we have to convert to tm and back to time_t.
-    // But it looks like it's not needed!
-    struct tm * timetm = localtime(&_ref_time);
-    //timetm->tm_sec += 5;
-    _ref_time = std::mktime(timetm);
-
-    for (auto& item: crontabs)
-    {
-      auto cron_obj = cron::make_cron(item);
-      std::time_t next = cron::cron_next(cron_obj, _ref_time);
-      start_times.push_back(next);
-    }
-
-    // Sorts (in-place) vector of start_times values from soonest to furthest.
-    std::sort(start_times.begin(), start_times.end(), [_ref_time](std::time_t& a, std::time_t& b)
-      { 
-        double diff_a = std::difftime(a, _ref_time);
-        double diff_b = std::difftime(b, _ref_time);
-        return diff_a<diff_b;
-      }
-    );  
-
-    return start_times;
-  }
   
 }; // Schedule class
 
@@ -766,10 +1369,12 @@ public:
   
   Schedule *schedule;
   std::string last_state;
+  std::time_t last_cronnext;
   
   CronNextSensor(Schedule* _schedule) :
     schedule(_schedule),
-    last_state("")
+    last_state(""),
+    last_cronnext(-1)
   {
     //set_name("Next Run");
     //set_object_id("cron_next_sensor_");
@@ -786,6 +1391,12 @@ public:
   }
   
   void loop() override {
+    // Only format the string when cronnext actually changes,
+    // instead of building a new string on every loop.
+    std::time_t new_cronnext = schedule->getCronNext();
+    if (new_cronnext == last_cronnext) { return; }
+    last_cronnext = new_cronnext;
+    
     std::string new_state = schedule->cronNextString("---");
     //state = schedule->cronNextString("---");
     
@@ -799,6 +1410,205 @@ public:
 }; // CronNextSensor class
 
 
+// Publishes cronnext as an ISO-8601 UTC string with device_class 'timestamp',
+// so Home Assistant gets a native timestamp without parsing local-time strings.
+// A float sensor can't hold an epoch value to the second (float has ~128s resolution
+// at current epoch values), so this is a text sensor, as with other esphome timestamps.
+class CronNextTimestampSensor : public text_sensor::TextSensor, public Component {
+public:
+  
+  Schedule *schedule;
+  std::time_t last_cronnext;
+  
+  CronNextTimestampSensor(Schedule* _schedule) :
+    schedule(_schedule),
+    last_cronnext(-1)
+  {
+    set_icon("mdi:timer-outline");
+    set_device_class("timestamp");
+    set_component_source("dynamic_cron");
+    App.register_text_sensor(this);
+    App.register_component(this);
+    schedule->cron_next_timestamp_sensor = this;
+  }
+  
+  void loop() override {
+    std::time_t new_cronnext = schedule->getCronNext();
+    if (new_cronnext == last_cronnext) { return; }
+    last_cronnext = new_cronnext;
+    
+    if (new_cronnext == 0) {
+      publish_state("");
+      return;
+    }
+    
+    struct tm timetm;
+    gmtime_r(&new_cronnext, &timetm);
+    char str[24];
+    strftime(str, sizeof(str), "%Y-%m-%dT%H:%M:%SZ", &timetm);
+    publish_state(str);
+  }
+  
+}; // CronNextTimestampSensor class
+
+
+// Publishes seconds-until-cronnext on an adaptive cadence:
+// rarely when the next run is far away, every second when it's close.
+// Publishing (and API traffic) scales with proximity to the next run,
+// not with loop frequency. A value that can't change until cronnext does
+// (no next run, or a run overdue while retrying) is published once.
+class CronCountdownSensor : public sensor::Sensor, public Component {
+public:
+  
+  Schedule *schedule;
+  std::time_t last_cronnext;
+  uint32_t next_publish_ms;
+  bool idle_published; // NAN or 0 already published for last_cronnext
+  
+  CronCountdownSensor(Schedule* _schedule) :
+    schedule(_schedule),
+    last_cronnext(-1),
+    next_publish_ms(0),
+    idle_published(false)
+  {
+    set_icon("mdi:timer-sand");
+    set_unit_of_measurement("s");
+    set_device_class("duration");
+    set_accuracy_decimals(0);
+    set_component_source("dynamic_cron");
+    App.register_sensor(this);
+    App.register_component(this);
+    schedule->cron_countdown_sensor = this;
+  }
+  
+  void loop() override {
+    std::time_t new_cronnext = schedule->getCronNext();
+    uint32_t now_ms = millis();
+    
+    bool changed = (new_cronnext != last_cronnext);
+    
+    if (!changed && (int32_t)(now_ms - next_publish_ms) < 0) { return; }
+    last_cronnext = new_cronnext;
+    if (changed) { idle_published = false; }
+    
+    double remaining = (new_cronnext == 0) ? NAN : std::max(0.0, std::difftime(new_cronnext, std::time(NULL)));
+    if (new_cronnext == 0 || remaining == 0) {
+      if (!idle_published) {
+        publish_state(remaining);
+        idle_published = true;
+      }
+      next_publish_ms = now_ms + 1000;
+      return;
+    }
+    
+    publish_state(remaining);
+    idle_published = false;
+    next_publish_ms = now_ms + PublishInterval(remaining) * 1000;
+  }
+  
+  // Seconds until the next publish, given seconds remaining until cronnext.
+  // Each tier is {remaining-above, interval}. The interval is clipped so we
+  // don't overshoot into the next (finer) tier.
+  static uint32_t PublishInterval(double remaining) {
+    static const uint32_t tiers[][2] = {
+      {86400, 900},
+      {3600,  60},
+      {300,   10}
+    };
+    for (auto& tier : tiers) {
+      if (remaining > tier[0]) {
+        double until_next_tier = remaining - tier[0];
+        return (uint32_t) std::max(1.0, std::min((double) tier[1], until_next_tier));
+      }
+    }
+    return 1;
+  }
+  
+}; // CronCountdownSensor class
+
+
+// Shows the schedule's recent firing history, most recent first.
+// The string is only built when the history changes.
+class CronHistorySensor : public text_sensor::TextSensor, public Component {
+public:
+  
+  Schedule *schedule;
+  uint32_t last_revision;
+  
+  CronHistorySensor(Schedule* _schedule) :
+    schedule(_schedule),
+    last_revision(UINT32_MAX) // forces an initial publish
+  {
+    set_icon("mdi:history");
+    set_entity_category(ENTITY_CATEGORY_DIAGNOSTIC);
+    set_component_source("dynamic_cron");
+    App.register_text_sensor(this);
+    App.register_component(this);
+    schedule->cron_history_sensor = this;
+  }
+  
+  void loop() override {
+    uint32_t new_revision = schedule->getHistoryRevision();
+    
+    if (new_revision != last_revision) {
+      last_revision = new_revision;
+      publish_state(schedule->historyString());
+    }
+  }
+  
+}; // CronHistorySensor class
+
+
+// Counts NVS opens, reads, writes, bytes written, or deferred cronnext writes, for one schedule,
+// or for all schedules (when schedule is nullptr). A total_increasing sensor,
+// so Home Assistant keeps long-term statistics and handles the reset at reboot.
+class NvsCounterSensor : public sensor::Sensor, public Component {
+public:
+  
+  enum Counter { OPENS, READS, WRITES, BYTES, DEFERRED };
+  
+  Schedule *schedule;
+  Counter counter;
+  uint32_t last_value;
+  bool published;
+  
+  NvsCounterSensor(Schedule* _schedule, Counter _counter) :
+    schedule(_schedule),
+    counter(_counter),
+    last_value(0),
+    published(false)
+  {
+    set_icon(counter == BYTES ? "mdi:database-arrow-down-outline" : "mdi:database-clock-outline");
+    if (counter == BYTES) { set_unit_of_measurement("B"); }
+    set_accuracy_decimals(0);
+    set_state_class(sensor::STATE_CLASS_TOTAL_INCREASING);
+    set_entity_category(ENTITY_CATEGORY_DIAGNOSTIC);
+    set_component_source("dynamic_cron");
+    App.register_sensor(this);
+    App.register_component(this);
+  }
+  
+  void loop() override {
+    const NvsStats& stats = (schedule != nullptr) ? schedule->getNvsStats() : Schedule::GlobalNvsStats();
+    uint32_t value;
+    switch (counter) {
+      case OPENS:  value = stats.opens; break;
+      case READS:  value = stats.reads; break;
+      case WRITES: value = stats.writes; break;
+      case BYTES:  value = stats.bytes; break;
+      default:     value = stats.deferred; break;
+    }
+    
+    if (!published || value != last_value) {
+      last_value = value;
+      published = true;
+      publish_state(value);
+    }
+  }
+  
+}; // NvsCounterSensor class
+
+
 class CrontabTextField : public text::Text, public Component {
 public:
   
@@ -827,7 +1637,7 @@ public:
   }
   
   void loop() override {
-    std::string new_state = schedule->getCrontab();
+    const std::string& new_state = schedule->getCrontab();
     
     if (new_state != last_state) {
       state = new_state;
@@ -839,12 +1649,92 @@ public:
   void control(const std::string &_state) {
     //ESP_LOGD("schedules", "CrontabTextField::control(): %i", &_state);
     schedule->setCrontab(_state);
+    
+    // If rejected (or normalized), shows the crontab actually in use.
+    if (schedule->getCrontab() != _state) {
+      state = schedule->getCrontab();
+      last_state = state;
+      publish_state(state);
+    }
   }
   
   
 }; // CrontabTextField class
 
 
+// Shows why the last crontab edit was rejected (which expression, which field, and why),
+// or is empty when the crontab was accepted.
+class CrontabErrorSensor : public text_sensor::TextSensor, public Component {
+public:
+  
+  Schedule *schedule;
+  uint32_t last_revision;
+  
+  CrontabErrorSensor(Schedule* _schedule) :
+    schedule(_schedule),
+    last_revision(UINT32_MAX) // forces an initial publish
+  {
+    set_icon("mdi:calendar-alert");
+    set_entity_category(ENTITY_CATEGORY_DIAGNOSTIC);
+    set_component_source("dynamic_cron");
+    App.register_text_sensor(this);
+    App.register_component(this);
+    schedule->crontab_error_sensor = this;
+  }
+  
+  void loop() override {
+    uint32_t new_revision = schedule->getCrontabErrorRevision();
+    
+    if (new_revision != last_revision) {
+      last_revision = new_revision;
+      publish_state(schedule->getCrontabError());
+    }
+  }
+  
+}; // CrontabErrorSensor class
+
+
+// Edits the schedule's excluded days. Invalid input is rejected,
+// and the field reverts to the current exclusions.
+class ExclusionsTextField : public text::Text, public Component {
+public:
+  
+  Schedule *schedule;
+  uint32_t last_revision;
+  
+  ExclusionsTextField(Schedule* _schedule) :
+    schedule(_schedule),
+    last_revision(UINT32_MAX) // forces an initial publish
+  {
+    set_disabled_by_default(false);
+    set_icon("mdi:calendar-remove-outline");
+    traits.set_min_length(0);
+    traits.set_max_length(255);
+    traits.set_mode(text::TEXT_MODE_TEXT);
+    set_component_source("dynamic_cron");
+    App.register_text(this);
+    App.register_component(this);
+    schedule->exclusions_text_field = this;
+  }
+  
+  void loop() override {
+    uint32_t new_revision = schedule->getExclusionsRevision();
+    
+    if (new_revision != last_revision) {
+      last_revision = new_revision;
+      publish_state(schedule->getExclusionsString());
+    }
+  }
+  
+  void control(const std::string &_state) {
+    if (!schedule->setExclusions(_state)) {
+      publish_state(schedule->getExclusionsString());
+    }
+  }
+  
+}; // ExclusionsTextField class
+
+
 } // dynamic_cron namespace
 } // esphome namespace
 
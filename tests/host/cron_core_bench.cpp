@@ -0,0 +1,177 @@
+// Host benchmark for the cron engine in cron_core.h. Prints timings, and fails only
+// if results are inconsistent, so it can run with the tests.
+
+#include "cron_core.h"
+#include "deadline_sim.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace esphome::dynamic_cron;
+
+
+static int failures = 0;
+
+
+static double ElapsedUs(std::chrono::steady_clock::time_point since) {
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - since).count();
+}
+
+
+// A month of runs for 50 schedules: 10 distinct crontabs, one schedule in five with
+// exclusions. Compares the merged timeline with computing each schedule on its own,
+// then sorting (the straightforward way).
+static void BenchTimeline() {
+  const char *crontabs[] = {
+    "0 0 6 * * *", "0 30 6,18 * * *", "0 */15 * * * *", "0 0 */2 * * *", "0 0 7 * * MON-FRI",
+    "0 0 8 * * SAT,SUN", "0 45 5 * * * | 0 45 19 * * *", "0 0 12 1,15 * *", "0 10 */3 * * *", "0 0 21 * * *",
+  };
+  ExclusionCalendar exclusions;
+  ExclusionCalendar::Parse("01-01, 07-04, 12-24..12-26", exclusions);
+
+  std::vector<TimelineSource> sources;
+  for (int i = 0; i < 50; i++) {
+    sources.push_back({SharedCrontab::Acquire(crontabs[i % 10]), (i % 5 == 4) ? &exclusions : nullptr});
+  }
+
+  std::time_t t1 = 1835481600; // 2028-03-01
+  std::time_t t2 = t1 + 31 * 86400;
+  const int rounds = 20;
+
+  std::vector<TimelineSource::Run> merged;
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    merged = TimelineSource::Merge(sources, t1, t2, (size_t) -1);
+  }
+  double merge_us = ElapsedUs(start) / rounds;
+
+  std::vector<TimelineSource::Run> naive;
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < rounds; r++) {
+    naive.clear();
+    for (size_t i = 0; i < sources.size(); i++) {
+      for (std::time_t t = t1 - 1; ; ) {
+        std::time_t next = 0;
+        for (auto& expr : sources[i].crontab->exprs) {
+          std::time_t n = expr.next(t, sources[i].exclusions);
+          if (n != 0 && (next == 0 || n < next)) { next = n; }
+        }
+        if (next == 0 || next >= t2) { break; }
+        naive.push_back({next, i});
+        t = next;
+      }
+    }
+    std::sort(naive.begin(), naive.end());
+  }
+  double naive_us = ElapsedUs(start) / rounds;
+
+  if (merged != naive) {
+    printf("FAIL timeline: merged %u runs, per-schedule %u runs\n", (unsigned) merged.size(), (unsigned) naive.size());
+    failures++;
+  }
+
+  std::time_t covered = 0;
+  std::vector<TimelineSource::Run> cut = TimelineSource::Merge(sources, t1, t2, 256, &covered);
+  if (covered >= t2 || cut.empty() || cut.back().first >= covered) {
+    printf("FAIL timeline: cut at 256 runs not reported\n");
+    failures++;
+  }
+
+  printf("timeline, 50 schedules x 31 days: %u runs\n", (unsigned) merged.size());
+  printf("  merged:       %10.0f us\n", merge_us);
+  printf("  per-schedule: %10.0f us\n", naive_us);
+  printf("  limit 256:    %u runs, covered %.1f days\n", (unsigned) cut.size(), (covered - t1) / 86400.0);
+
+  for (auto& source : sources) {
+    SharedCrontab::Release(const_cast<SharedCrontab*>(source.crontab));
+  }
+}
+
+
+// Firing lateness of a minutely schedule, over 6 hours of virtual time on an ESPHome-like
+// main loop (DeadlineSim, driving the same DeadlineTimer decisions as Schedule):
+//  - polling only, as before the deadline timer, for boot times at each second of the
+//    6 s polling cycle (lateness depends on where the boot fell in it);
+//  - the deadline timer, on a millis() drifting 200 ppm from the clock;
+//  - the same, with time syncs stepping the clock 30 s forward, then back, mid-wait.
+//    (A step also moves the polling cycle, so some runs are fired by polling, on time.)
+static void BenchLateness() {
+  CronExpr minutely;
+  CronExpr::Parse("0 * * * * *", minutely);
+  const int64_t hour_ms = 3600000;
+
+  auto print = [](const char *label, const DeadlineSim::Result& r) {
+    printf("  %-18s %5lld runs, late %5lld..%5lld ms, mean %5lld ms, %5lld wakeups, %3lld re-arms, %3lld polled\n", label,
+      (long long) r.runs, (long long) r.min_late_ms, (long long) r.max_late_ms,
+      (long long) (r.total_late_ms / std::max(r.runs, (int64_t) 1)), (long long) r.wakeups, (long long) r.rearms, (long long) r.polled_runs);
+  };
+
+  DeadlineSim sim;
+  sim.start_ms = 1835481600357LL; // 2028-03-01
+  sim.duration_ms = 6 * hour_ms;
+  sim.drift = 200e-6;
+  printf("lateness, minutely schedule, 6 h simulated, %lld ms loop:\n", (long long) sim.tick_ms);
+
+  DeadlineSim::Result polling;
+  sim.use_timer = false;
+  for (int phase = 0; phase < 6; phase++) {
+    DeadlineSim boot = sim;
+    boot.start_ms += phase * 1000;
+    DeadlineSim::Result r = boot.run(minutely);
+    polling.runs += r.runs;
+    polling.polled_runs += r.polled_runs;
+    polling.total_late_ms += r.total_late_ms;
+    polling.min_late_ms = std::min(polling.min_late_ms, r.min_late_ms);
+    polling.max_late_ms = std::max(polling.max_late_ms, r.max_late_ms);
+  }
+  print("polling, 6 boots:", polling);
+
+  sim.use_timer = true;
+  sim.start_ms += 2000; // off the polling cycle, so the timer (not polling) fires
+  DeadlineSim::Result steady = sim.run(minutely);
+  print("deadline:", steady);
+
+  for (int64_t h = 0; h < 6; h++) {
+    sim.steps.push_back({h * hour_ms + 20 * 60000 + 20000, 30000});
+    sim.steps.push_back({h * hour_ms + 40 * 60000 + 20000, -30000});
+  }
+  DeadlineSim::Result stepped = sim.run(minutely);
+  print("deadline, 12 steps:", stepped);
+
+  if (steady.min_late_ms < 0 || steady.max_late_ms > 2 * sim.tick_ms ||
+      stepped.min_late_ms < 0 || stepped.max_late_ms > 2 * sim.tick_ms) {
+    printf("FAIL lateness: deadline runs early, or later than 2 loop ticks\n");
+    failures++;
+  }
+
+  // A few real runs, at the next whole seconds, sleeping as the timer would.
+  auto now_ms = []() {
+    return (int64_t) std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  };
+  int64_t real_max = 0;
+  for (int i = 0; i < 3; i++) {
+    DeadlineTimer timer;
+    std::time_t target = now_ms() / 1000 + 1;
+    while (!DeadlineTimer::Due(target, now_ms())) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(timer.arm(target, now_ms(), 0)));
+    }
+    real_max = std::max(real_max, now_ms() - (int64_t) target * 1000);
+  }
+  printf("  deadline, 3 real runs: max %lld ms late\n", (long long) real_max);
+}
+
+
+int main() {
+  setenv("TZ", "EST5EDT,M3.2.0,M11.1.0", 1);
+  tzset();
+
+  BenchTimeline();
+  BenchLateness();
+
+  return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,360 @@
+// Host test for the cron engine in cron_core.h: parsing, next-time search and DST.
+// Runs with plain libc TZ strings, so no zoneinfo files are needed.
+
+#include "cron_core.h"
+#include "deadline_sim.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <time.h>
+
+using namespace esphome::dynamic_cron;
+
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+  if (!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } \
+} while (0)
+
+#define CHECK_TIME(actual, expected) do { \
+  long long a_ = (long long) (actual), e_ = (long long) (expected); \
+  if (a_ != e_) { printf("FAIL %s:%d: %s = %lld, expected %lld\n", __FILE__, __LINE__, #actual, a_, e_); failures++; } \
+} while (0)
+
+
+static const char *NEW_YORK = "EST5EDT,M3.2.0,M11.1.0";
+static const char *SYDNEY   = "AEST-10AEDT,M10.1.0,M4.1.0/3";
+
+
+static void SetTz(const char *tz) {
+  setenv("TZ", tz, 1);
+  tzset();
+}
+
+
+// UTC time for a civil date and time.
+static std::time_t Utc(int y, unsigned mo, unsigned d, int h = 0, int mi = 0, int s = 0) {
+  return (std::time_t) (TzTable::DaysFromCivil(y, mo, d) * 86400 + h * 3600 + mi * 60 + s);
+}
+
+
+static CronExpr Expr(const char *text) {
+  CronExpr expr;
+  std::string error;
+  if (!CronExpr::Parse(text, expr, &error)) {
+    printf("FAIL could not parse '%s': %s\n", text, error.c_str());
+    failures++;
+  }
+  return expr;
+}
+
+
+// True if libc local time at 'utc' matches the expression.
+static bool Matches(const CronExpr& expr, std::time_t utc) {
+  struct tm tm_local;
+  localtime_r(&utc, &tm_local);
+  return (expr.seconds >> tm_local.tm_sec & 1) && (expr.minutes >> tm_local.tm_min & 1) &&
+         (expr.hours >> tm_local.tm_hour & 1) && (expr.days_of_month >> tm_local.tm_mday & 1) &&
+         (expr.months >> (tm_local.tm_mon + 1) & 1) && (expr.days_of_week >> tm_local.tm_wday & 1);
+}
+
+
+static void TestParseErrors() {
+  CronExpr expr;
+  std::string error;
+
+  CHECK(!CronExpr::Parse("0 0 * * *", expr, &error));
+  CHECK(error == "expected 6 fields, found 5");
+
+  CHECK(!CronExpr::Parse("0 61 * * * *", expr, &error));
+  CHECK(error == "field 2 (minute) '61': '61' is out of range 0-59");
+
+  CHECK(!CronExpr::Parse("0 0 0 0 * *", expr, &error));
+  CHECK(error == "field 4 (day-of-month) '0': '0' is out of range 1-31");
+
+  CHECK(!CronExpr::Parse("0 0 5-2 * * *", expr, &error));
+  CHECK(error == "field 3 (hour) '5-2': range '5-2' is reversed");
+
+  CHECK(!CronExpr::Parse("0 0 0 * FOO *", expr, &error));
+  CHECK(error == "field 5 (month) 'FOO': 'FOO' is not a valid value");
+
+  CHECK(!CronExpr::Parse("*/0 * * * * *", expr, &error));
+  CHECK(error.find("step") != std::string::npos);
+
+  CHECK(!CronExpr::Parse("0 0 ? * * *", expr, &error));
+  CHECK(!CronExpr::Parse("0 0 0 1, * *", expr, &error));
+  CHECK(error == "field 4 (day-of-month) '1,': missing value");
+
+  CHECK(SharedCrontab::Validate("0 0 * * * * | 0 0 12 * * MON", &error));
+  CHECK(!SharedCrontab::Validate("0 0 * * * * | 0 0 25 * * *", &error));
+  CHECK(error.find("expression 2") == 0);
+}
+
+
+static void TestFields() {
+  CronExpr expr = Expr("*/15 5/20 1-10/3 ? * *");
+  CHECK(expr.seconds == ((1ULL << 0) | (1ULL << 15) | (1ULL << 30) | (1ULL << 45)));
+  CHECK(expr.minutes == ((1ULL << 5) | (1ULL << 25) | (1ULL << 45)));
+  CHECK(expr.hours == ((1u << 1) | (1u << 4) | (1u << 7) | (1u << 10)));
+  CHECK(expr.days_of_month == 0xFFFFFFFEu);
+  CHECK(expr.hours != CronExpr::ALL_HOURS);
+  CHECK(Expr("0 0 * * * *").hours == CronExpr::ALL_HOURS);
+
+  expr = Expr("0 0 12 * jan-Mar,DEC MON-FRI");
+  CHECK(expr.months == ((1u << 1) | (1u << 2) | (1u << 3) | (1u << 12)));
+  CHECK(expr.days_of_week == 0x3E);
+  CHECK(Expr("0 0 12 * JAN-MAR,DEC MON-FRI").months == expr.months);
+}
+
+
+static void TestCalendar() {
+  SetTz("UTC0");
+
+  // Day-of-month AND day-of-week: first Friday the 13th of 2028.
+  CHECK_TIME(Expr("0 0 0 13 * FRI").next(Utc(2028, 1, 1)), Utc(2028, 10, 13));
+
+  // Feb 29, only in leap years.
+  CHECK_TIME(Expr("0 0 0 29 2 *").next(Utc(2025, 1, 1)), Utc(2028, 2, 29));
+  CHECK_TIME(Expr("0 0 0 29 2 *").next(Utc(2028, 2, 29)), Utc(2032, 2, 29));
+
+  // Never matches (Feb 30).
+  CHECK_TIME(Expr("0 0 0 30 2 *").next(Utc(2028, 1, 1)), 0);
+
+  // Strictly after the given time.
+  CHECK_TIME(Expr("0 0 12 * * *").next(Utc(2028, 5, 5, 12)), Utc(2028, 5, 6, 12));
+  CHECK_TIME(Expr("*/15 * * * * *").next(Utc(2028, 5, 5, 12, 0, 14)), Utc(2028, 5, 5, 12, 0, 15));
+
+  ExclusionCalendar exclusions;
+  CHECK(ExclusionCalendar::Parse("05-06..05-07", exclusions));
+  CHECK_TIME(Expr("0 0 12 * * *").next(Utc(2028, 5, 5, 13), &exclusions), Utc(2028, 5, 8, 12));
+}
+
+
+static void TestNewYork() {
+  SetTz(NEW_YORK);
+
+  // Spring forward, Sun 2028-03-12 02:00 EST -> 03:00 EDT (07:00 UTC).
+  // A skipped fixed time runs at the transition instant, once.
+  CronExpr daily = Expr("0 30 2 * * *");
+  CHECK_TIME(daily.next(Utc(2028, 3, 12, 6, 30)), Utc(2028, 3, 12, 7));
+  CHECK_TIME(daily.next(Utc(2028, 3, 12, 7)), Utc(2028, 3, 13, 6, 30));
+
+  // Same, through the libc fallback used outside the table.
+  CHECK_TIME(TzTable::LibcToUtc(Utc(2028, 3, 12, 2, 30), false), Utc(2028, 3, 12, 7));
+  CHECK_TIME(TzTable::LibcToUtc(Utc(2028, 11, 5, 1, 30), false), Utc(2028, 11, 5, 5, 30));
+  CHECK_TIME(TzTable::LibcToUtc(Utc(2028, 11, 5, 1, 30), true), Utc(2028, 11, 5, 6, 30));
+
+  CronExpr every_20 = Expr("0 */20 * * * *");
+  CHECK_TIME(every_20.next(Utc(2028, 3, 12, 6, 40)), Utc(2028, 3, 12, 7));
+  CHECK_TIME(every_20.next(Utc(2028, 3, 12, 7)), Utc(2028, 3, 12, 7, 20));
+
+  // Fall back, Sun 2028-11-05 02:00 EDT -> 01:00 EST (06:00 UTC).
+  // A fixed hour runs on the first pass only.
+  CronExpr repeated = Expr("0 30 1 * * *");
+  CHECK_TIME(repeated.next(Utc(2028, 11, 5, 5)), Utc(2028, 11, 5, 5, 30));
+  CHECK_TIME(repeated.next(Utc(2028, 11, 5, 5, 30)), Utc(2028, 11, 6, 6, 30));
+  CHECK_TIME(repeated.next(Utc(2028, 11, 5, 6, 10)), Utc(2028, 11, 6, 6, 30));
+
+  // A wildcard hour keeps running through the second pass.
+  CHECK_TIME(every_20.next(Utc(2028, 11, 5, 5, 40)), Utc(2028, 11, 5, 6));
+  CHECK_TIME(every_20.next(Utc(2028, 11, 5, 6)), Utc(2028, 11, 5, 6, 20));
+  CHECK_TIME(every_20.next(Utc(2028, 11, 5, 6, 40)), Utc(2028, 11, 5, 7));
+}
+
+
+static void TestSydney() {
+  SetTz(SYDNEY);
+
+  // Spring forward, Sun 2028-10-01 02:00 AEST -> 03:00 AEDT (Sep 30 16:00 UTC).
+  CronExpr daily = Expr("0 30 2 * * *");
+  CHECK_TIME(daily.next(Utc(2028, 9, 30, 15, 30)), Utc(2028, 9, 30, 16));
+  CHECK_TIME(daily.next(Utc(2028, 9, 30, 16)), Utc(2028, 10, 1, 15, 30));
+
+  // Fall back, Sun 2028-04-02 03:00 AEDT -> 02:00 AEST (Apr 1 16:00 UTC).
+  CHECK_TIME(daily.next(Utc(2028, 4, 1, 15)), Utc(2028, 4, 1, 15, 30));
+  CHECK_TIME(daily.next(Utc(2028, 4, 1, 15, 30)), Utc(2028, 4, 2, 16, 30));
+
+  CronExpr every_20 = Expr("0 */20 * * * *");
+  CHECK_TIME(every_20.next(Utc(2028, 4, 1, 15, 40)), Utc(2028, 4, 1, 16));
+  CHECK_TIME(every_20.next(Utc(2028, 4, 1, 16, 40)), Utc(2028, 4, 1, 17));
+}
+
+
+// Wildcard-hour entries must match every real (UTC) time whose local time matches,
+// and every result must move forward, around each transition.
+static void TestForward(const char *tz, std::time_t from, std::time_t to) {
+  SetTz(tz);
+
+  const char *texts[] = {"0 */20 * * * *", "0 15 * * * *", "30 */7 * * * *"};
+  for (const char *text : texts) {
+    CronExpr expr = Expr(text);
+    std::time_t t = from;
+    while (t < to) {
+      std::time_t found = expr.next(t);
+      std::time_t expected = t + 1;
+      while (!Matches(expr, expected)) { expected++; }
+      if (found != expected) {
+        printf("FAIL %s '%s' from %lld: %lld, expected %lld\n", tz, text, (long long) t, (long long) found, (long long) expected);
+        failures++;
+        break;
+      }
+      t = found;
+    }
+  }
+
+  const char *fixed[] = {"0 30 1 * * *", "0 30 2 * * *", "0 0 2,3 * * *", "0 59 1 * * SUN"};
+  for (const char *text : fixed) {
+    CronExpr expr = Expr(text);
+    std::time_t t = from;
+    for (int i = 0; i < 10; i++) {
+      std::time_t found = expr.next(t);
+      CHECK(found > t);
+      t = found;
+    }
+  }
+}
+
+
+// The TZ table isn't built from an unsynced clock, and is rebuilt when time moves on.
+static void TestUnsyncedClock() {
+  SetTz(NEW_YORK);
+  CronExpr daily = Expr("0 30 2 * * *");
+
+  CHECK(daily.next(1000) > 1000);
+  CHECK_TIME(daily.next(Utc(2028, 3, 12, 6, 30)), Utc(2028, 3, 12, 7));
+
+  bool found = false;
+  for (auto& tr : TzTable::Local().getTransitions()) {
+    if (tr.at == Utc(2028, 3, 12, 7)) { found = true; }
+  }
+  CHECK(found);
+
+  // Back in time, then far ahead.
+  CHECK_TIME(daily.next(Utc(2026, 3, 8, 6, 30)), Utc(2026, 3, 8, 7));
+  CHECK_TIME(daily.next(Utc(2031, 3, 9, 6, 30)), Utc(2031, 3, 9, 7));
+}
+
+
+// Timeline merge: order, sharing, de-duplication and truncation.
+static void TestTimeline() {
+  SetTz("UTC0");
+  SharedCrontab *hourly = SharedCrontab::Acquire("0 0 * * * *");
+  SharedCrontab *twice  = SharedCrontab::Acquire("0 0 */2 * * * | 0 0 */4 * * *");
+  ExclusionCalendar exclusions;
+  ExclusionCalendar::Parse("05-06", exclusions);
+
+  std::vector<TimelineSource> sources = {{hourly, nullptr}, {twice, nullptr}, {nullptr, nullptr}, {hourly, &exclusions}};
+  std::time_t t1 = Utc(2028, 5, 5, 22), t2 = Utc(2028, 5, 6, 2);
+  std::time_t covered = 0;
+
+  // 22:00 (0, 1, 3), 23:00 (0, 3), 00:00 (0, 1), 01:00 (0).
+  std::vector<TimelineSource::Run> runs = TimelineSource::Merge(sources, t1, t2, 100, &covered);
+  CHECK(runs.size() == 8);
+  CHECK_TIME(covered, t2);
+  CHECK(runs[0] == TimelineSource::Run(t1, 0) && runs[1] == TimelineSource::Run(t1, 1) && runs[2] == TimelineSource::Run(t1, 3));
+  CHECK(runs[6] == TimelineSource::Run(Utc(2028, 5, 6, 0), 1));
+
+  // Cut at 6 runs: the partial 00:00 instant is dropped, [t1, covered) is complete.
+  runs = TimelineSource::Merge(sources, t1, t2, 6, &covered);
+  CHECK(runs.size() == 5);
+  CHECK_TIME(covered, Utc(2028, 5, 6, 0));
+
+  SharedCrontab::Release(hourly);
+  SharedCrontab::Release(twice);
+}
+
+
+// NVS write-budget refill, over gaps long enough to overflow 32-bit math.
+static void TestRefillTokens() {
+  CHECK(RefillTokens(0, 60000, 60) == 1);
+  CHECK(RefillTokens(0, 1800000, 60) == 30);
+  CHECK(RefillTokens(10, 0, 60) == 10);
+  CHECK(RefillTokens(0, 4296000, 1000) == 1000);      // 71.6 minutes
+  CHECK(RefillTokens(0, 72000000, 60) == 60);         // 20 hours
+  CHECK(RefillTokens(0, 4294967295u, 100000) == 100000);
+  CHECK(RefillTokens(0, 36000, 1000) == 10);
+}
+
+
+// Deadline timer decisions, then a device simulation with clock steps mid-wait.
+static void TestDeadlineTimer() {
+  std::time_t due = Utc(2028, 3, 1, 0, 1);
+  int64_t due_ms = (int64_t) due * 1000;
+
+  // Due at the exact second, not a second later.
+  CHECK(!DeadlineTimer::Due(due, due_ms - 1));
+  CHECK(DeadlineTimer::Due(due, due_ms));
+  CHECK(!DeadlineTimer::Due(0, due_ms));
+
+  DeadlineTimer timer;
+  CHECK(timer.arm(due, due_ms - 500, 1000) == 500);
+  CHECK(timer.arm(due, due_ms - 3600000, 1000) == DeadlineTimer::MAX_MS);
+  CHECK(timer.arm(due, due_ms + 500, 1000) == 0);
+  CHECK(timer.arm(0, due_ms, 1000) == -1);
+
+  timer.arm(due, due_ms - 60000, 1000);
+  CHECK(!timer.needsRearm(due, due_ms - 50000, 11000));
+  CHECK(!timer.needsRearm(due, due_ms - 49900, 11000));    // 100 ms: drift, not a step
+  CHECK(timer.needsRearm(due + 60, due_ms - 50000, 11000)); // due time changed
+  CHECK(timer.needsRearm(due, due_ms - 20000, 11000));     // clock stepped forward
+  CHECK(timer.needsRearm(due, due_ms - 80000, 11000));     // clock stepped back
+
+  // millis() wrapping re-arms once.
+  timer.arm(due, due_ms - 10000, 0xFFFFFF00u);
+  CHECK(timer.needsRearm(due, due_ms - 9488, 0x100u));
+  timer.arm(due, due_ms - 9488, 0x100u);
+  CHECK(!timer.needsRearm(due, due_ms - 9000, 0x2F0u));
+
+  SetTz("UTC0");
+  CronExpr minutely = Expr("0 * * * * *");
+  DeadlineSim sim;
+  sim.start_ms = (int64_t) Utc(2028, 3, 1, 0, 0, 2) * 1000 + 357; // polls at hh:mm:02, :08...
+  sim.drift = 200e-6;
+
+  DeadlineSim::Result r = sim.run(minutely);
+  CHECK(r.runs == 60);
+  CHECK(r.min_late_ms >= 0 && r.max_late_ms <= 2 * sim.tick_ms);
+  CHECK(r.polled_runs == 0);
+
+  // Clock steps 20 s into a wait: forward 30 s, later back 30 s.
+  // Re-anchoring keeps runs on time, and never early.
+  sim.steps = {{30 * 60000 + 20000, 30000}, {45 * 60000 + 20000, -30000}};
+  r = sim.run(minutely);
+  CHECK(r.runs == 60);
+  CHECK(r.min_late_ms >= 0 && r.max_late_ms <= 2 * sim.tick_ms);
+  CHECK(r.polled_runs == 0);
+  CHECK(r.rearms == 2);
+
+  // Polling only, as before the timer: up to loop_interval + 1 s late.
+  sim.use_timer = false;
+  sim.steps.clear();
+  r = sim.run(minutely);
+  CHECK(r.runs == 60 && r.polled_runs == 60);
+  CHECK(r.max_late_ms > 1000 && r.max_late_ms <= 6000 + sim.tick_ms);
+}
+
+
+int main() {
+  TestParseErrors();
+  TestFields();
+  TestCalendar();
+  TestNewYork();
+  TestSydney();
+  TestForward(NEW_YORK, Utc(2028, 3, 11), Utc(2028, 3, 13));
+  TestForward(NEW_YORK, Utc(2028, 11, 4), Utc(2028, 11, 6));
+  TestForward(SYDNEY, Utc(2028, 3, 31), Utc(2028, 4, 3));
+  TestForward(SYDNEY, Utc(2028, 9, 29), Utc(2028, 10, 2));
+  TestUnsyncedClock();
+  TestTimeline();
+  TestRefillTokens();
+  TestDeadlineTimer();
+
+  if (failures > 0) {
+    printf("%d failure(s)\n", failures);
+    return 1;
+  }
+  printf("all passed\n");
+  return 0;
+}
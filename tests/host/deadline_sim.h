@@ -0,0 +1,111 @@
+#pragma once
+
+// Virtual-time model of a device firing one schedule, shared by the host test and
+// benchmark. It drives the same decisions Schedule makes (DeadlineTimer, and the
+// loop_interval polling fallback), on an ESPHome-like main loop: every tick, the
+// scheduler runs due timeouts, then loop() runs.
+
+#include "cron_core.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+
+namespace esphome {
+namespace dynamic_cron {
+
+
+struct DeadlineSim {
+
+  // A wall-clock step (time sync) of 'step_ms', at 'at_ms' of millis().
+  struct ClockStep {
+    int64_t   at_ms;
+    int64_t   step_ms;
+  };
+
+  struct Result {
+    int64_t   runs = 0;
+    int64_t   total_late_ms = 0;
+    int64_t   min_late_ms = INT64_MAX;
+    int64_t   max_late_ms = 0;
+    int64_t   wakeups = 0;        // timer callbacks
+    int64_t   rearms = 0;         // re-arms from loop() (cronnext changed, or clock stepped)
+    int64_t   polled_runs = 0;    // runs fired by the polling check
+  };
+
+  int64_t                 start_ms = 0;       // wall clock at millis() 0
+  int64_t                 duration_ms = 3600000;
+  int64_t                 tick_ms = 16;       // main loop period
+  double                  drift = 0;          // wall-clock rate error of millis()
+  double                  loop_interval = 5;  // polling check, seconds
+  bool                    use_timer = true;   // false: polling only, as before the timer
+  std::vector<ClockStep>  steps;
+
+
+  Result run(const CronExpr& expr) const {
+    Result r;
+    DeadlineTimer deadline;
+    bool timer_pending = false;
+    uint32_t timer_at = 0;
+
+    int64_t wall_ms = start_ms;
+    std::time_t cronnext = expr.next(wall_ms / 1000);
+    std::time_t previous = wall_ms / 1000;
+
+    auto fire = [&](int64_t now_ms) {
+      int64_t late = now_ms - (int64_t) cronnext * 1000;
+      r.runs++;
+      r.total_late_ms += late;
+      r.min_late_ms = std::min(r.min_late_ms, late);
+      r.max_late_ms = std::max(r.max_late_ms, late);
+      cronnext = expr.next(now_ms / 1000);
+    };
+    auto arm = [&](int64_t now_ms, uint32_t millis_now) {
+      int64_t delay_ms = deadline.arm(cronnext, now_ms, millis_now);
+      timer_pending = (delay_ms >= 0);
+      timer_at = millis_now + (uint32_t) delay_ms;
+    };
+
+    if (use_timer) { arm(wall_ms, 0); }
+
+    for (int64_t mono = 0; mono < duration_ms; mono += tick_ms) {
+      uint32_t millis_now = (uint32_t) mono;
+      int64_t stepped = 0;
+      for (auto& step : steps) {
+        if (mono >= step.at_ms) { stepped += step.step_ms; }
+      }
+      wall_ms = start_ms + (int64_t) (mono * (1.0 + drift)) + stepped;
+
+      // Scheduler: the "deadline" timeout (Schedule::onDeadline()).
+      if (use_timer && timer_pending && (int32_t) (millis_now - timer_at) >= 0) {
+        timer_pending = false;
+        r.wakeups++;
+        if (DeadlineTimer::Due(cronnext, wall_ms)) { fire(wall_ms); }
+        arm(wall_ms, millis_now);
+      }
+
+      // Schedule::loop(): re-arm check, then the polling fallback.
+      if (use_timer && deadline.needsRearm(cronnext, wall_ms, millis_now)) {
+        r.rearms++;
+        arm(wall_ms, millis_now);
+      }
+      std::time_t now = wall_ms / 1000;
+      if (now - previous > loop_interval) {
+        if (DeadlineTimer::Due(cronnext, (int64_t) now * 1000)) {
+          r.polled_runs++;
+          fire(wall_ms);
+        }
+        previous = now;
+      }
+    }
+
+    if (r.runs == 0) { r.min_late_ms = 0; }
+    return r;
+  }
+
+}; // DeadlineSim struct
+
+
+} // dynamic_cron namespace
+} // esphome namespace
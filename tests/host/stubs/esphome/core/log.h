@@ -0,0 +1,7 @@
+#pragma once
+
+// Host stand-in for ESPHome logging, so cron_core.h builds without the framework.
+#define ESP_LOGD(tag, ...) do {} while (0)
+#define ESP_LOGI(tag, ...) do {} while (0)
+#define ESP_LOGW(tag, ...) do {} while (0)
+#define ESP_LOGE(tag, ...) do {} while (0)